@@ -0,0 +1,365 @@
+/*
+ * simavr benchmark harness.  Runs the master firmware (bench_master.c) and n
+ * copies of the slave firmware (bench_slave.c), each on its own simulated core,
+ * with their bus pins wired together.
+ *
+ * Usage: avrbench [-n slaves] [-r rounds] master.elf slave.elf
+ *
+ * The bus is a wired-AND with a pullup: it is low while any core drives its pin
+ * low (DDR set, PORT clear), and high otherwise.  It rises instantly.  The cores
+ * run in lockstep, one instruction at a time, always stepping the core that is
+ * furthest behind in simulated time, so each sees the others' edges on time.
+ *
+ * For each phase the master marks (see avrbench.h), prints:
+ * - simulated time, and bus throughput for the buffer phases
+ * - host (wall) time
+ * - the master's interrupts-off time per operation, and the longest stretch
+ * - the slaves' longest interrupts-off stretch
+ * and then the flash and static SRAM footprint of each firmware.
+ *
+ * Exits nonzero if a phase fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_eeprom.h"
+
+#include "avrbench.h"
+
+// The master's identifier list holds 16 (DALLAS_NUM_DEVICES)
+#define MAX_SLAVES 16
+
+// Where the bus and the GPIOR registers are on each part.  Must match
+// conf/<part>/one_wire_conf.h .
+typedef struct {
+	const char * name;
+	char port;
+	uint8_t pin;
+	// Data space addresses
+	uint16_t gpior0;
+	uint16_t gpior1;
+	uint16_t gpior2;
+} PART_t;
+
+const PART_t parts[] = {
+	{ "attiny44", 'A', 3, 0x33, 0x34, 0x35 },
+	{ "atmega328p", 'B', 0, 0x3E, 0x4A, 0x4B },
+};
+
+typedef struct {
+	avr_t * avr;
+	const PART_t * part;
+	uint64_t cycle_ps;
+	avr_irq_t * pin_irq;
+	// Bus pin bits of the last PORT and DDR writes
+	uint8_t port;
+	uint8_t ddr;
+	// Interrupts-off tracking
+	uint8_t irq_enabled;
+	uint8_t irq_ever_enabled;
+	uint64_t irq_off_since;
+	uint64_t irq_off_ps;
+	uint64_t irq_off_max_ps;
+} CORE_t;
+
+CORE_t cores[MAX_SLAVES + 1];
+uint8_t num_cores;
+// The master is cores[0]
+#define master (&cores[0])
+
+uint8_t bus_level = 1;
+uint64_t bus_edges = 0;
+
+uint8_t num_slaves = 8;
+uint8_t rounds = 10;
+uint16_t failures = 0;
+
+// Phase being timed
+uint8_t phase = 0;
+uint64_t phase_start_ps;
+uint64_t phase_start_edges;
+double phase_start_wall;
+uint8_t done = 0;
+
+uint32_t rand_state = 0x12345678;
+
+uint32_t xorshift(void) {
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+double wall_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t core_time(CORE_t * core) {
+	return core->avr->cycle * core->cycle_ps;
+}
+
+void fail(const char * what) {
+	fprintf(stderr, "FAIL: %s\n", what);
+	failures++;
+}
+
+//////////
+// Bus //
+//////////
+
+void update_bus(void) {
+	uint8_t level = 1;
+	uint8_t i;
+
+	for (i = 0; i < num_cores; i++) {
+		if (cores[i].ddr && !cores[i].port) level = 0;
+	}
+	if (level == bus_level) return;
+	bus_level = level;
+	if (!level) bus_edges++;
+	for (i = 0; i < num_cores; i++) {
+		avr_raise_irq(cores[i].pin_irq, level);
+	}
+}
+
+void port_written(struct avr_irq_t * irq, uint32_t value, void * param) {
+	CORE_t * core = param;
+	core->port = (value >> core->part->pin) & 1;
+	update_bus();
+}
+
+void ddr_written(struct avr_irq_t * irq, uint32_t value, void * param) {
+	CORE_t * core = param;
+	core->ddr = (value >> core->part->pin) & 1;
+	update_bus();
+}
+
+//////////////////////
+// Interrupts off  //
+//////////////////////
+
+void update_irq(CORE_t * core) {
+	uint8_t enabled = core->avr->sreg[S_I];
+	uint64_t off;
+
+	if (enabled == core->irq_enabled) return;
+	core->irq_enabled = enabled;
+	if (!enabled) {
+		core->irq_off_since = core_time(core);
+	} else if (core->irq_ever_enabled) {
+		off = core_time(core) - core->irq_off_since;
+		core->irq_off_ps += off;
+		if (off > core->irq_off_max_ps) core->irq_off_max_ps = off;
+	} else {
+		core->irq_ever_enabled = 1;
+	}
+}
+
+void clear_irq_stats(void) {
+	uint8_t i;
+	for (i = 0; i < num_cores; i++) {
+		cores[i].irq_off_ps = 0;
+		cores[i].irq_off_max_ps = 0;
+		// A stretch in progress counts from now
+		if (!cores[i].irq_enabled) cores[i].irq_off_since = core_time(&cores[i]);
+	}
+}
+
+/////////////
+// Phases //
+/////////////
+
+const char * phase_name(uint8_t p) {
+	switch (p) {
+		case BENCH_PHASE_SEARCH: return "search";
+		case BENCH_PHASE_REQUEST: return "request";
+		case BENCH_PHASE_READ: return "read";
+		case BENCH_PHASE_WRITE: return "write";
+	}
+	return "?";
+}
+
+void phase_end(void) {
+	uint8_t result = master->avr->data[master->part->gpior1];
+	uint8_t ops = master->avr->data[master->part->gpior2];
+	double sim_s = (core_time(master) - phase_start_ps) / 1e12;
+	double wall_s = wall_seconds() - phase_start_wall;
+	uint64_t slave_max = 0;
+	uint8_t i;
+
+	// Stretches still in progress
+	for (i = 0; i < num_cores; i++) update_irq(&cores[i]);
+	for (i = 1; i < num_cores; i++) {
+		if (cores[i].irq_off_max_ps > slave_max) slave_max = cores[i].irq_off_max_ps;
+	}
+
+	printf("%-8s %10.3f ms simulated  %8.3f s wall  %8llu slots", phase_name(phase), sim_s * 1e3, wall_s,
+			(unsigned long long)(bus_edges - phase_start_edges));
+	if (phase == BENCH_PHASE_READ || phase == BENCH_PHASE_WRITE) {
+		printf("  %7.0f bytes/s", ops * BENCH_BUF_LEN / sim_s);
+	}
+	printf("\n         master interrupts off %.1f us/op, %.1f us longest  slaves %.1f us longest\n",
+			ops ? master->irq_off_ps / 1e6 / ops : 0.0, master->irq_off_max_ps / 1e6, slave_max / 1e6);
+
+	if (phase == BENCH_PHASE_SEARCH) {
+		if (result != num_slaves) fail("search didn't find every slave");
+	} else if (result) {
+		fail("phase had failures");
+	}
+	phase = 0;
+}
+
+void gpior0_written(struct avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param) {
+	avr->data[addr] = v;
+	if (v == BENCH_PHASE_END) {
+		phase_end();
+	} else if (v == BENCH_PHASE_EXIT) {
+		done = 1;
+	} else {
+		phase = v;
+		phase_start_ps = core_time(master);
+		phase_start_edges = bus_edges;
+		phase_start_wall = wall_seconds();
+		clear_irq_stats();
+	}
+}
+
+//////////////
+// Set up  //
+//////////////
+
+// Loads firmware onto a new core.  Returns null on failure.
+CORE_t * add_core(const char * path) {
+	CORE_t * core = &cores[num_cores];
+	elf_firmware_t firmware;
+	uint8_t i;
+
+	memset(&firmware, 0, sizeof(firmware));
+	if (elf_read_firmware(path, &firmware)) {
+		fprintf(stderr, "Can't read %s\n", path);
+		return 0;
+	}
+	for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+		if (!strcmp(parts[i].name, firmware.mmcu)) core->part = &parts[i];
+	}
+	if (!core->part) {
+		fprintf(stderr, "%s: unsupported part %s\n", path, firmware.mmcu);
+		return 0;
+	}
+	core->avr = avr_make_mcu_by_name(firmware.mmcu);
+	if (!core->avr) return 0;
+	avr_init(core->avr);
+	core->avr->frequency = firmware.frequency;
+	avr_load_firmware(core->avr, &firmware);
+	core->cycle_ps = 1000000000000ULL / firmware.frequency;
+
+	core->pin_irq = avr_io_getirq(core->avr, AVR_IOCTL_IOPORT_GETIRQ(core->part->port), core->part->pin);
+	avr_irq_register_notify(avr_io_getirq(core->avr, AVR_IOCTL_IOPORT_GETIRQ(core->part->port), IOPORT_IRQ_REG_PORT),
+			port_written, core);
+	avr_irq_register_notify(avr_io_getirq(core->avr, AVR_IOCTL_IOPORT_GETIRQ(core->part->port), IOPORT_IRQ_DIRECTION_ALL),
+			ddr_written, core);
+	avr_raise_irq(core->pin_irq, bus_level);
+
+	num_cores++;
+	return core;
+}
+
+void set_eeprom(CORE_t * core, uint8_t * data, uint8_t len) {
+	avr_eeprom_desc_t desc;
+	desc.ee = data;
+	desc.offset = 0;
+	desc.size = len;
+	avr_ioctl(core->avr, AVR_IOCTL_EEPROM_SET, &desc);
+}
+
+// Bitwise Maxim crc8
+uint8_t crc8(uint8_t * buf, uint8_t len) {
+	uint8_t crc = 0;
+	uint8_t i;
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+void print_footprint(const char * path) {
+	elf_firmware_t firmware;
+	memset(&firmware, 0, sizeof(firmware));
+	if (elf_read_firmware(path, &firmware)) return;
+	printf("%-24s %-10s flash %5u bytes  static SRAM %4u bytes\n", path, firmware.mmcu,
+			(unsigned)firmware.flashsize, (unsigned)(firmware.datasize + firmware.bsssize));
+}
+
+void usage(const char * name) {
+	fprintf(stderr, "Usage: %s [-n slaves] [-r rounds] master.elf slave.elf\n", name);
+	exit(2);
+}
+
+int main(int argc, char ** argv) {
+	CORE_t * core;
+	CORE_t * next;
+	uint8_t id[8];
+	uint8_t i;
+	int state;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+			case 'n': num_slaves = atoi(optarg); break;
+			case 'r': rounds = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2 || num_slaves < 1 || num_slaves > MAX_SLAVES || !rounds) usage(argv[0]);
+
+	if (!add_core(argv[optind])) return 2;
+	set_eeprom(master, &rounds, 1);
+	avr_register_io_write(master->avr, master->part->gpior0, gpior0_written, 0);
+
+	for (i = 0; i < num_slaves; i++) {
+		core = add_core(argv[optind + 1]);
+		if (!core) return 2;
+		id[0] = 0x28;
+		for (opt = 1; opt < 7; opt++) id[opt] = xorshift();
+		id[7] = crc8(id, 7);
+		set_eeprom(core, id, 8);
+	}
+
+	printf("master %s, %u x slave %s, %u rounds\n", argv[optind], num_slaves, argv[optind + 1], rounds);
+
+	while (!done) {
+		next = &cores[0];
+		for (i = 1; i < num_cores; i++) {
+			if (core_time(&cores[i]) < core_time(next)) next = &cores[i];
+		}
+		state = avr_run(next->avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fail("a core stopped");
+			break;
+		}
+		update_irq(next);
+	}
+
+	printf("\n");
+	print_footprint(argv[optind]);
+	print_footprint(argv[optind + 1]);
+
+	if (failures) {
+		printf("%u checks FAILED\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,27 @@
+// Shared by the benchmark firmware and the harness (avrbench.c)
+
+#ifndef AVRBENCH_H
+#define AVRBENCH_H
+
+// Phase marks, written by the master to GPIOR0
+#define BENCH_PHASE_END 0x01
+#define BENCH_PHASE_SEARCH 0x10
+#define BENCH_PHASE_REQUEST 0x11
+#define BENCH_PHASE_READ 0x12
+#define BENCH_PHASE_WRITE 0x13
+#define BENCH_PHASE_EXIT 0xFF
+
+// Slave commands (see bench_slave.c)
+#define BENCH_READ_SCRATCHPAD 0xBE
+#define BENCH_WRITE_SCRATCHPAD 0x4E
+#define BENCH_STREAM_OUT 0xAA
+#define BENCH_STREAM_IN 0x0F
+
+// Bytes per dallas_read_buffer() / dallas_write_buffer() call
+#define BENCH_BUF_LEN 32
+
+// Master EEPROM byte holding the number of rounds of each phase, set by the
+// harness.  Slaves keep their identifier at 0.
+#define BENCH_ROUNDS_EEPROM_ADDR (const uint8_t *)0
+
+#endif
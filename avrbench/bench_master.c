@@ -0,0 +1,113 @@
+/*
+ * Master firmware for the simavr benchmark (see avrbench.c).
+ *
+ * Runs each phase, marking where it starts and ends in GPIOR0 so the harness can
+ * time it.  Before the end mark, GPIOR1 holds the phase's failures (or, for the
+ * search, the number of devices found) and GPIOR2 the number of operations.
+ */
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "avr_mcu_section.h"
+#include "dallas_one_wire.h"
+#include "one_wire_request.h"
+#include "avrbench.h"
+
+AVR_MCU(F_CPU, MCU_NAME);
+
+// Initial scratchpad of every slave (see bench_slave.c)
+const uint8_t scratchpad[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+
+uint8_t buf[BENCH_BUF_LEN];
+
+void phase_end(uint8_t result, uint8_t ops) {
+	GPIOR1 = result;
+	GPIOR2 = ops;
+	GPIOR0 = BENCH_PHASE_END;
+}
+
+void bench_search(void) {
+	GPIOR0 = BENCH_PHASE_SEARCH;
+	if (dallas_search_identifiers()) {
+		phase_end(0, 1);
+		return;
+	}
+	phase_end(get_identifier_list()->num_devices, 1);
+}
+
+void bench_request(uint8_t rounds) {
+	DALLAS_IDENTIFIER_LIST_t * list = get_identifier_list();
+	uint8_t request = BENCH_READ_SCRATCHPAD;
+	uint8_t response[9];
+	uint8_t failed = 0;
+	uint8_t round;
+	uint8_t i;
+
+	GPIOR0 = BENCH_PHASE_REQUEST;
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < list->num_devices; i++) {
+			if (dallas_request(&list->identifiers[i], DALLAS_REQ_EXPECT_CKSUM8, 1, &request, sizeof(response), response)
+					|| memcmp(response, scratchpad, sizeof(scratchpad))) {
+				failed++;
+			}
+		}
+	}
+	phase_end(failed, rounds * list->num_devices);
+}
+
+void bench_read(uint8_t rounds) {
+	uint8_t failed = 0;
+	uint8_t i;
+
+	dallas_match_rom(&get_identifier_list()->identifiers[0]);
+	dallas_write_byte(BENCH_STREAM_OUT);
+	GPIOR0 = BENCH_PHASE_READ;
+	for (i = 0; i < rounds; i++) {
+		dallas_read_buffer(buf, sizeof(buf));
+		if (dallas_bus_error || memcmp(buf, scratchpad, sizeof(scratchpad))) failed++;
+	}
+	phase_end(failed, rounds);
+	dallas_reset();
+}
+
+void bench_write(uint8_t rounds) {
+	uint8_t failed = 0;
+	uint8_t i;
+
+	dallas_match_rom(&get_identifier_list()->identifiers[0]);
+	dallas_write_byte(BENCH_STREAM_IN);
+	memset(buf, 0x5A, sizeof(buf));
+	GPIOR0 = BENCH_PHASE_WRITE;
+	for (i = 0; i < rounds; i++) {
+		dallas_write_buffer(buf, sizeof(buf));
+		if (dallas_bus_error) failed++;
+	}
+	phase_end(failed, rounds);
+	dallas_reset();
+}
+
+int main(void) {
+	uint8_t rounds = eeprom_read_byte(BENCH_ROUNDS_EEPROM_ADDR);
+
+	// Give the slaves time to start up
+	_delay_ms(1);
+	dallas_setup();
+	// Count the master's interrupts-off time too
+	sei();
+
+	bench_search();
+	if (get_identifier_list()->num_devices) {
+		bench_request(rounds);
+		bench_read(rounds);
+		bench_write(rounds);
+	}
+
+	GPIOR0 = BENCH_PHASE_EXIT;
+	cli();
+	for (;;);
+}
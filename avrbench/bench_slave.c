@@ -0,0 +1,48 @@
+/*
+ * Slave firmware for the simavr benchmark (see avrbench.c).
+ *
+ * Device commands:
+ * 0xBE: read scratchpad.  Sends the 8 byte scratchpad and its crc8.
+ * 0x4E: write scratchpad.  Reads 8 bytes into the scratchpad.
+ * 0xAA: sends the scratchpad over and over, until the master resets the bus.
+ * 0x0F: reads bytes, until the master resets the bus.
+ */
+
+#include <avr/io.h>
+#include <stdint.h>
+
+#include "avr_mcu_section.h"
+#include "one_wire_slave.h"
+#include "avrbench.h"
+
+AVR_MCU(F_CPU, MCU_NAME);
+
+uint8_t scratchpad[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+
+void handle_ows_command(uint8_t command) {
+	uint16_t crc = 0;
+	uint8_t b;
+
+	switch (command) {
+		case BENCH_READ_SCRATCHPAD:
+			if (ows_write_buf_crc(scratchpad, sizeof(scratchpad), OWS_CRC8, &crc)) return;
+			ows_write_byte(crc);
+			break;
+		case BENCH_WRITE_SCRATCHPAD:
+			ows_read_buf(scratchpad, sizeof(scratchpad));
+			break;
+		case BENCH_STREAM_OUT:
+			while (!ows_write_buf(scratchpad, sizeof(scratchpad)));
+			break;
+		case BENCH_STREAM_IN:
+			while (!ows_read_buf(&b, 1));
+			break;
+	}
+}
+
+int main(void) {
+	ows_setup();
+	// Spin rather than sleep: simavr skips ahead while a core sleeps, which would
+	// let a slave miss the start of a slot
+	for (;;);
+}
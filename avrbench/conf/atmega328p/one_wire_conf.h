@@ -0,0 +1,33 @@
+// one_wire_conf.h for the simavr benchmark on the atmega328p.  The Makefile
+// force-includes this ahead of the sources, so the conf next to them is skipped
+// (same guard).
+
+#ifndef ONE_WIRE_CONF_H
+#define ONE_WIRE_CONF_H
+
+// F_CPU is set by the Makefile
+
+// Bus on PB0 (PCINT0).  Must match the parts table in avrbench.c .
+#define DALLAS_PORT PORTB
+#define DALLAS_PORT_IN PINB
+#define DALLAS_DDR DDRB
+#define DALLAS_PIN 0
+
+// Slave pin change interrupt.  The slave writes GIMSK and GIFR, which this part
+// calls PCICR and PCIFR.
+#define DALLAS_PCINT_VECT PCINT0_vect
+#define DALLAS_PCINT_MASK PCMSK0
+#define DALLAS_PCINT_BIT 0
+#define DALLAS_GIMSK_BIT PCIE0
+#define DALLAS_GIFR_BIT PCIF0
+#define GIMSK PCICR
+#define GIFR PCIFR
+
+// Slave reset timer
+#define DALLAS_TIMER DALLAS_TIMER_0_8BIT
+#define DALLAS_TIMER_VECT TIMER0_COMPA_vect
+
+// Slaves read their identifier from the start of their EEPROM
+#define OWS_ID_EEPROM_ADDR (const uint8_t *)0
+
+#endif
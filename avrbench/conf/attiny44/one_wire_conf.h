@@ -0,0 +1,30 @@
+// one_wire_conf.h for the simavr benchmark on the attiny44.  The Makefile
+// force-includes this ahead of the sources, so the conf next to them is skipped
+// (same guard).
+
+#ifndef ONE_WIRE_CONF_H
+#define ONE_WIRE_CONF_H
+
+// F_CPU is set by the Makefile
+
+// Bus on PA3 (PCINT3).  Must match the parts table in avrbench.c .
+#define DALLAS_PORT PORTA
+#define DALLAS_PORT_IN PINA
+#define DALLAS_DDR DDRA
+#define DALLAS_PIN 3
+
+// Slave pin change interrupt
+#define DALLAS_PCINT_VECT PCINT0_vect
+#define DALLAS_PCINT_MASK PCMSK0
+#define DALLAS_PCINT_BIT 3
+#define DALLAS_GIMSK_BIT 4
+#define DALLAS_GIFR_BIT 4
+
+// Slave reset timer
+#define DALLAS_TIMER DALLAS_TIMER_0_8BIT
+#define DALLAS_TIMER_VECT TIM0_COMPA_vect
+
+// Slaves read their identifier from the start of their EEPROM
+#define OWS_ID_EEPROM_ADDR (const uint8_t *)0
+
+#endif
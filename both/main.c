@@ -9,7 +9,7 @@
 #ifdef OWS_DEBUG_LED_PORT
 #define led_on() OWS_DEBUG_LED_PORT &= ~_BV(OWS_DEBUG_LED_PIN);
 #define led_off() OWS_DEBUG_LED_PORT |= _BV(OWS_DEBUG_LED_PIN);
-inline void led_blink(uint8_t n) {
+static inline void led_blink(uint8_t n) {
 	uint8_t i;
 	for (i = 0; i < n; i++) {
 		led_on();
@@ -19,7 +19,7 @@ inline void led_blink(uint8_t n) {
 	}
 }
 
-inline void led_blink_bit(uint8_t b) {
+static inline void led_blink_bit(uint8_t b) {
 	if (b) {
 		led_on();
 		_delay_ms(800);
@@ -33,7 +33,7 @@ inline void led_blink_bit(uint8_t b) {
 	}
 }
 
-inline void led_blink_byte(uint8_t b) {
+static inline void led_blink_byte(uint8_t b) {
 	uint8_t p;
 	for(p = 0x80; p; p >>= 1) {
 		led_blink_bit(b & p);
@@ -87,6 +87,9 @@ int main(void) {
 	PORTA = 0xff;
 	ows_setup();
 	dallas_setup();
+	// Back off differently from other masters on the bus.  The crc byte of our
+	// slave identifier is unique enough.
+	dallas_txn_seed(ows_id.identifier[7]);
 	while(1) {
 		//ows_check();
 	}
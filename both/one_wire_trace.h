@@ -0,0 +1 @@
+../common/one_wire_trace.h
\ No newline at end of file
@@ -1,68 +1,239 @@
-/** DOES NOT YET WORK **/
 #ifndef DELAY_HELPERS_H
 #define DELAY_HELPERS_H
 
-#include <avr/cpufunc.h>
+#include <avr/io.h>
 #include <util/delay_basic.h>
+#include <stdint.h>
 
 /*
-These are helper macros for functions that need precise microsecond-level timing that
-iterate and perform a synchronous operation each cycle.  These loops are typically
-in the form:
-
-void doStuffForMicroseconds(uint8_t microseconds) {
-	microseconds = DELAY_ROUND_DOWN(microseconds, 6);
-	for (; microseconds; microseconds -= DELAY_DECR_USECS(6)) {
-		DELAY_EXTRA_NOPS(6)
-		// Do operation
+These are helpers for loops that need to poll a pin for a precise number of
+microseconds, such as "wait up to 30 us for the bus to go high".  The loops are
+written in assembly, so the number of cycles per iteration is known exactly
+instead of depending on the compiler:
+
+	if (DELAY_POLL_UNTIL_CLEAR(PINA, 3, 30)) {
+		// The pin stayed high for 30 us
 	}
-}
 
-The '6' in this example is the number of cycles consumed by the loop without any
-extra inserted instructions.  This number of cycles must include any compares,
-branches, and decrements, as well as the internal operation.
+The number of iterations for a window is computed at compile time, rounded up to
+the next whole iteration, and checked statically: if the window needs no
+iterations or more than a 16-bit counter can hold at this F_CPU, the build
+fails.  The microsecond arguments must therefore be constants.
+
+F_CPU can be anything from 1 MHz to 20 MHz, and need not be a whole number of
+MHz.  The register passed to the poll macros must be in the low I/O space (any
+PINx register on the supported parts).
+*/
 
-The DELAY_EXTRA_NOPS macro inserts extra NOPs to make the number of cycles per iteration
-an even multiple of the frequency.
+#if F_CPU < 1000000UL || F_CPU > 20000000UL
+#error "F_CPU must be between 1 MHz and 20 MHz"
+#endif
 
-The DELAY_DECR_USECS macro returns the amount to decrement microseconds by each loop
-iteration.
+// Fails the build (with name in the error message) if cond is false, or if cond
+// isn't a constant.  Can be used at file scope or inside a block.
+#define DELAY_STATIC_ASSERT(cond, name) __extension__ _Static_assert(cond, #name)
 
-The DELAY_ROUND_DOWN or DELAY_ROUND_UP macros round microseconds to an even
-multiple of DELAY_DECR_USECS so decrementing by DELAY_DECR_USECS won't make
-the counter go below 0.
+// Number of cycles in us microseconds, rounded up
+#define DELAY_US_TO_CYCLES(us) (((us) * (F_CPU / 1000UL) + 999UL) / 1000UL)
 
-The F_CPU macro must be defined, and must be a multiple of 1,000,000 up to 16,000,000.
+// Number of iterations of a loop_cycles cycle loop needed to cover us microseconds,
+// rounded up
+#define DELAY_LOOP_ITERATIONS(us, loop_cycles) ((DELAY_US_TO_CYCLES(us) + (loop_cycles) - 1UL) / (loop_cycles))
 
-Be warned: If the compiler tries to unroll the resulting loop, timing could break.
-Check the assembly generated to ensure it looks sane.
+// Cycles per iteration of the poll loops below
+#define DELAY_POLL_CYCLES 6
 
-*/
+// Fails the build if a poll of us microseconds can't be counted at this F_CPU
+#define DELAY_ASSERT_POLL(us) DELAY_STATIC_ASSERT(DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES) >= 1 && DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES) <= 0xFFFFUL, poll_window_fits_16_bits)
 
-// Divides numer by denom, rounding up (such that constant values will be optimized away)
-// Result should be cast to the desired type
-#define INT_DIV_ROUND_UP(numer, denom) (numer / denom + ((numer % denom) ? 1 : 0))
+// Fails the build if us microseconds is less than overhead_cycles, ie to check
+// that the instructions around a delay fit inside a timing window
+#define DELAY_ASSERT_BUDGET(us, overhead_cycles, name) DELAY_STATIC_ASSERT(DELAY_US_TO_CYCLES(us) >= (overhead_cycles), name)
 
-// Macro to round up to next highest power of 2 (for 8 bits)
-// Note: There are more efficient ways to do this without preoptimized macros
-#define NEXT_HIGHEST_POWER_OF_2(v) (((v-1)|((v-1)>>1)|((v-1)>>2)|((v-1)>>3)|((v-1)>>4)|((v-1)>>5)|((v-1)>>6)|((v-1)>>7))+1)
+// Delays for us microseconds, less overhead_cycles spent by the surrounding
+// instructions.  Check the budget with DELAY_ASSERT_BUDGET first.
+#define DELAY_US_MINUS_CYCLES(us, overhead_cycles) __builtin_avr_delay_cycles(DELAY_US_TO_CYCLES(us) - (overhead_cycles))
 
-// Given a power of 2 (ie, a single bit set), returns a value with that bit, and all lower bits set
-// Works for 8-bit numbers
-#define POWER_OF_2_MASK(v) (v|(v>>1)|(v>>2)|(v>>3)|(v>>4)|(v>>5)|(v>>6)|(v>>7))
+// Number of iterations of a poll loop needed to cover us microseconds at run time.
+// Clamped to 1 to 0xFFFF.
+#define DELAY_POLL_ITERATIONS_RUNTIME(us) delay_clamp_iterations(((uint32_t)(us) * (F_CPU / 1000UL) + 999UL) / 1000UL, DELAY_POLL_CYCLES, 0, 1)
 
-#define DELAY_CYCLES_EXACT_HELPER(n) if (n == 1) { _NOP(); } else if (n == 2) { _NOP(); _NOP(); }
-#define DELAY_LOOP_1_ITERATIONS(n) ((uint8_t)(n / 3))
-#define DELAY_CYCLES_EXACT(n) if (n > 2) { _delay_loop_1(DELAY_LOOP_1_ITERATIONS(n)); } if (n % 3) { DELAY_CYCLES_EXACT_HELPER(n % 3); }
+// Number of _delay_loop_2() iterations (4 cycles each) for us microseconds less
+// overhead_cycles, at run time.  Clamped to 0 (no delay) to 0xFFFF.
+#define DELAY_LOOP_2_ITERATIONS_RUNTIME(us, overhead_cycles) delay_clamp_iterations(((uint32_t)(us) * (F_CPU / 1000UL) + 999UL) / 1000UL, 4, overhead_cycles, 0)
 
-// Number of cycles in each microsecond
-#define CYCLES_PER_USEC (F_CPU / 1000000UL)
+// Converts cycles to iterations of a loop_cycles cycle loop, after subtracting
+// overhead_cycles, and rounding up.  The result is clamped to min_iterations to
+// 0xFFFF.
+static inline uint16_t delay_clamp_iterations(uint32_t cycles, uint8_t loop_cycles, uint8_t overhead_cycles, uint8_t min_iterations) {
+	cycles = (cycles > overhead_cycles) ? cycles - overhead_cycles : 0;
+	cycles = (cycles + loop_cycles - 1) / loop_cycles;
+	if (cycles < min_iterations) return min_iterations;
+	if (cycles > 0xFFFFUL) return 0xFFFF;
+	return (uint16_t)cycles;
+}
 
-#define DELAY_DECR_USECS(loop_cycles) ((uint8_t)NEXT_HIGHEST_POWER_OF_2(INT_DIV_ROUND_UP(loop_cycles, CYCLES_PER_USEC)))
-#define DELAY_NUM_EXTRA_CYCLES(loop_cycles) (DELAY_DECR_USECS(loop_cycles) * CYCLES_PER_USEC - loop_cycles)
-#define DELAY_EXTRA_NOPS(loop_cycles) DELAY_CYCLES_EXACT(DELAY_NUM_EXTRA_CYCLES(loop_cycles))
-#define DELAY_ROUND_DOWN(usecs, loop_cycles) (usecs & ~(POWER_OF_2_MASK(DELAY_DECR_USECS(loop_cycles))>>1))
-#define DELAY_ROUND_UP(usecs, loop_cycles) (DELAY_ROUND_DOWN(usecs, loop_cycles) == usecs) ? usecs : ((usecs | (POWER_OF_2_MASK(DELAY_DECR_USECS(loop_cycles))>>1))+1)
+#ifdef OW_SIM
+
+// Host simulation (see sim/sim.h).  sim_poll() runs the same loop, checking the
+// register every DELAY_POLL_CYCLES cycles, but sleeps between bus edges instead
+// of spinning.
+
+#define DELAY_POLL_UNTIL_CLEAR(reg, bit, us) ({ \
+		DELAY_ASSERT_POLL(us); \
+		sim_poll(&(reg), _BV(bit), 0, DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES), DELAY_POLL_CYCLES) ? 0 : 1; \
+	})
+
+#define DELAY_POLL_UNTIL_SET(reg, bit, us) ({ \
+		DELAY_ASSERT_POLL(us); \
+		sim_poll(&(reg), _BV(bit), 1, DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES), DELAY_POLL_CYCLES) ? 0 : 1; \
+	})
+
+#define DELAY_POLL_UNTIL_SET_COUNTED(reg, bit, us, polls) ({ \
+		DELAY_ASSERT_POLL(us); \
+		uint16_t delay_n = sim_poll(&(reg), _BV(bit), 1, DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES), DELAY_POLL_CYCLES); \
+		(polls) = DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES) - delay_n; \
+		delay_n ? 0 : 1; \
+	})
+
+#define DELAY_POLL_SET_ONCE(reg, bit, us) ({ \
+		DELAY_ASSERT_POLL(us); \
+		DELAY_POLL_SET_ONCE_N(reg, bit, DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES)); \
+	})
+
+#define DELAY_POLL_SET_ONCE_N(reg, bit, iterations) ({ \
+		uint16_t delay_polls __attribute__((unused)); \
+		DELAY_POLL_SET_ONCE_N_COUNTED(reg, bit, iterations, delay_polls); \
+	})
+
+#define DELAY_POLL_SET_ONCE_N_COUNTED(reg, bit, iterations, polls) ({ \
+		uint16_t delay_total = (iterations); \
+		uint16_t delay_n = sim_poll(&(reg), _BV(bit), 1, delay_total, DELAY_POLL_CYCLES); \
+		uint8_t delay_res = 1; \
+		(polls) = delay_total - delay_n; \
+		if (delay_n) { \
+			delay_res = sim_poll(&(reg), _BV(bit), 0, delay_n, DELAY_POLL_CYCLES) ? 2 : 0; \
+		} \
+		delay_res; \
+	})
+
+#else
+
+// Polls bit of an I/O register until it is clear, for up to us microseconds.
+// Evaluates to 0 if the bit cleared, or 1 on timeout.
+#define DELAY_POLL_UNTIL_CLEAR(reg, bit, us) ({ \
+		DELAY_ASSERT_POLL(us); \
+		uint16_t delay_n = DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES); \
+		__asm__ __volatile__ ( \
+			"1: sbis %[io], %[b]\n\t"	/* 2 cycles (skip) while set */ \
+			"rjmp 2f\n\t" \
+			"sbiw %[n], 1\n\t"		/* 2 cycles */ \
+			"brne 1b\n\t"			/* 2 cycles */ \
+			"2:\n\t" \
+			: [n] "+w" (delay_n) \
+			: [io] "I" (_SFR_IO_ADDR(reg)), [b] "I" (bit)); \
+		delay_n ? 0 : 1; \
+	})
+
+// Polls bit of an I/O register until it is set, for up to us microseconds.
+// Evaluates to 0 if the bit was set, or 1 on timeout.
+#define DELAY_POLL_UNTIL_SET(reg, bit, us) ({ \
+		DELAY_ASSERT_POLL(us); \
+		uint16_t delay_n = DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES); \
+		__asm__ __volatile__ ( \
+			"1: sbic %[io], %[b]\n\t"	/* 2 cycles (skip) while clear */ \
+			"rjmp 2f\n\t" \
+			"sbiw %[n], 1\n\t" \
+			"brne 1b\n\t" \
+			"2:\n\t" \
+			: [n] "+w" (delay_n) \
+			: [io] "I" (_SFR_IO_ADDR(reg)), [b] "I" (bit)); \
+		delay_n ? 0 : 1; \
+	})
+
+// Same as DELAY_POLL_UNTIL_SET(), and also sets polls (a uint16_t lvalue) to the
+// number of iterations it took, or the whole window on timeout.
+#define DELAY_POLL_UNTIL_SET_COUNTED(reg, bit, us, polls) ({ \
+		DELAY_ASSERT_POLL(us); \
+		uint16_t delay_n = DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES); \
+		__asm__ __volatile__ ( \
+			"1: sbic %[io], %[b]\n\t"	/* 2 cycles (skip) while clear */ \
+			"rjmp 2f\n\t" \
+			"sbiw %[n], 1\n\t" \
+			"brne 1b\n\t" \
+			"2:\n\t" \
+			: [n] "+w" (delay_n) \
+			: [io] "I" (_SFR_IO_ADDR(reg)), [b] "I" (bit)); \
+		(polls) = DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES) - delay_n; \
+		delay_n ? 0 : 1; \
+	})
+
+// For a window of us microseconds, waits for bit of an I/O register to be set
+// (if it isn't already), then makes sure it stays set for the rest of the window.
+// Evaluates to 0 if the bit was set for the end of the window and was only set
+// once, 1 if it never got set, or 2 if it was cleared again.
+#define DELAY_POLL_SET_ONCE(reg, bit, us) ({ \
+		DELAY_ASSERT_POLL(us); \
+		DELAY_POLL_SET_ONCE_N(reg, bit, DELAY_LOOP_ITERATIONS(us, DELAY_POLL_CYCLES)); \
+	})
+
+// Same as DELAY_POLL_SET_ONCE(), for a number of poll iterations known at run time
+// (at least 1).
+#define DELAY_POLL_SET_ONCE_N(reg, bit, iterations) ({ \
+		uint16_t delay_n = (iterations); \
+		uint8_t delay_res; \
+		__asm__ __volatile__ ( \
+			"ldi %[r], 1\n\t" \
+			/* Wait for the bit to be set */ \
+			"1: sbic %[io], %[b]\n\t"	/* 2 cycles (skip) while clear */ \
+			"rjmp 3f\n\t" \
+			"sbiw %[n], 1\n\t" \
+			"brne 1b\n\t" \
+			"rjmp 4f\n\t" \
+			/* Make sure it stays set */ \
+			"3: ldi %[r], 2\n\t" \
+			"5: sbis %[io], %[b]\n\t"	/* 2 cycles (skip) while set */ \
+			"rjmp 4f\n\t" \
+			"sbiw %[n], 1\n\t" \
+			"brne 5b\n\t" \
+			"clr %[r]\n\t" \
+			"4:\n\t" \
+			: [n] "+w" (delay_n), [r] "=&d" (delay_res) \
+			: [io] "I" (_SFR_IO_ADDR(reg)), [b] "I" (bit)); \
+		delay_res; \
+	})
+
+// Same as DELAY_POLL_SET_ONCE_N(), and also sets polls (a uint16_t lvalue) to the
+// number of iterations it took for the bit to be set, or the whole window if it
+// never was.  The window is one cycle longer than DELAY_POLL_SET_ONCE_N()'s.
+#define DELAY_POLL_SET_ONCE_N_COUNTED(reg, bit, iterations, polls) ({ \
+		uint16_t delay_total = (iterations); \
+		uint16_t delay_n = delay_total; \
+		uint16_t delay_rise = 0; \
+		uint8_t delay_res; \
+		__asm__ __volatile__ ( \
+			"ldi %[r], 1\n\t" \
+			/* Wait for the bit to be set */ \
+			"1: sbic %[io], %[b]\n\t"	/* 2 cycles (skip) while clear */ \
+			"rjmp 3f\n\t" \
+			"sbiw %[n], 1\n\t" \
+			"brne 1b\n\t" \
+			"rjmp 4f\n\t" \
+			/* Note how many iterations were left, and make sure it stays set */ \
+			"3: movw %[t], %[n]\n\t" \
+			"ldi %[r], 2\n\t" \
+			"5: sbis %[io], %[b]\n\t"	/* 2 cycles (skip) while set */ \
+			"rjmp 4f\n\t" \
+			"sbiw %[n], 1\n\t" \
+			"brne 5b\n\t" \
+			"clr %[r]\n\t" \
+			"4:\n\t" \
+			: [n] "+w" (delay_n), [r] "=&d" (delay_res), [t] "+r" (delay_rise) \
+			: [io] "I" (_SFR_IO_ADDR(reg)), [b] "I" (bit)); \
+		(polls) = delay_total - delay_rise; \
+		delay_res; \
+	})
 
+#endif
 
 #endif
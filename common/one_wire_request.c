@@ -1,43 +1,158 @@
 #include "one_wire_request.h"
 #include "maxim_crc.h"
-#include <util/delay.h>
 
-#define NUM_RETRIES 5
-// both in milliseconds
-#define RETRY_INITIAL_DELAY 0
-#define RETRY_DELAY_BACKOFF 2
+// Backoff after bus errors for the default retry policy, in microseconds.  The
+// delay doubles with each attempt, up to RETRY_MAX_DELAY.
+#define RETRY_INITIAL_DELAY 100
+#define RETRY_MAX_DELAY 6400
 
-inline uint8_t dallas_request_base(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
+uint16_t dallas_retry_default_backoff(uint8_t result, uint8_t attempt) {
+	uint16_t delay;
+	// Retrying won't help
+	if (result == DALLAS_ERR_UNSUPPORTED) return DALLAS_RETRY_STOP;
+	// Bad data was probably noise.  Try again right away.
+	if (result == DALLAS_ERR_ALL_ONES || result == DALLAS_ERR_CRC) return 0;
+	// Bus errors back off exponentially, in case someone else is using the bus
+	delay = RETRY_INITIAL_DELAY;
+	while (--attempt && delay < RETRY_MAX_DELAY) delay <<= 1;
+	return (delay < RETRY_MAX_DELAY) ? delay : RETRY_MAX_DELAY;
+}
+
+DALLAS_RETRY_POLICY_t dallas_retry_default_policy = { DALLAS_RETRY_MAX, dallas_retry_default_backoff, 0 };
+DALLAS_RETRY_POLICY_t * dallas_retry_policy = &dallas_retry_default_policy;
+
+void dallas_set_retry_policy(DALLAS_RETRY_POLICY_t * policy) {
+	dallas_retry_policy = policy ? policy : &dallas_retry_default_policy;
+}
+
+uint16_t dallas_retry_wait_us = 0;
+
+// The request that last returned DALLAS_ERR_RETRY_PENDING, and how many attempts
+// it has made.  retry_pending_attempt is 0 if there is none.
+DALLAS_IDENTIFIER_t * retry_pending_id;
+uint8_t * retry_pending_request;
+uint8_t retry_pending_attempt = 0;
+
+#if DALLAS_DEVICE_STATS_LEN > 0
+DALLAS_DEVICE_STATS_t device_stats[DALLAS_DEVICE_STATS_LEN];
+uint8_t num_device_stats = 0;
+// Statistics of the device addressed by the current dallas_request_retry(), or
+// null
+DALLAS_DEVICE_STATS_t * request_stats = 0;
+
+static inline uint8_t same_identifier(DALLAS_IDENTIFIER_t * a, DALLAS_IDENTIFIER_t * b) {
+	uint8_t i;
+	for (i = 0; i < DALLAS_NUM_IDENTIFIER_BITS / 8; i++) {
+		if (a->identifier[i] != b->identifier[i]) return 0;
+	}
+	return 1;
+}
+
+DALLAS_DEVICE_STATS_t * dallas_get_device_stats(DALLAS_IDENTIFIER_t * id) {
+	uint8_t i;
+	for (i = 0; i < num_device_stats; i++) {
+		if (same_identifier(&device_stats[i].id, id)) return &device_stats[i];
+	}
+	return 0;
+}
+
+// Returns the statistics of a device, starting to track it if there is room
+DALLAS_DEVICE_STATS_t * device_stats_add(DALLAS_IDENTIFIER_t * id) {
+	DALLAS_DEVICE_STATS_t * stats = dallas_get_device_stats(id);
+	if (stats || num_device_stats >= DALLAS_DEVICE_STATS_LEN) return stats;
+	stats = &device_stats[num_device_stats++];
+	stats->id = *id;
+	stats->attempts = 0;
+	stats->retries = 0;
+	stats->crc_failures = 0;
+	stats->bus_errors = 0;
+	stats->last_error = 0;
+	stats->bus_time = 0;
+	return stats;
+}
+
+uint8_t dallas_device_stats_count(void) {
+	return num_device_stats;
+}
+
+DALLAS_DEVICE_STATS_t * dallas_device_stats_at(uint8_t i) {
+	return &device_stats[i];
+}
+
+void dallas_clear_device_stats(void) {
+	num_device_stats = 0;
+}
+
+// Counts one attempt of the current request
+static inline void count_attempt(uint8_t attempt, uint8_t result) {
+	if (!request_stats) return;
+	request_stats->attempts++;
+	if (attempt) request_stats->retries++;
+	request_stats->last_error = result;
+	if (result == DALLAS_ERR_ALL_ONES || result == DALLAS_ERR_CRC) {
+		request_stats->crc_failures++;
+	} else if (result) {
+		request_stats->bus_errors++;
+	}
+}
+#else
+#define count_attempt(attempt, result)
+#endif
+
+static inline uint8_t dallas_request_base(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
 	uint8_t cur_byte;
-	uint8_t bit_ctr;
+	uint8_t crc_type = 0;
+	uint16_t crc = 0;
 
 	// Send the ROM command
-	if (id) {
-		dallas_match_rom(id);
+	if (flags & DALLAS_REQ_OVERDRIVE) {
+		if (id && (flags & DALLAS_REQ_RESUME) && dallas_can_resume(id, DALLAS_SPEED_OVERDRIVE)) {
+			// The device is still at overdrive
+			dallas_set_speed(DALLAS_SPEED_OVERDRIVE);
+			dallas_resume();
+		} else if (id) {
+			dallas_overdrive_match_rom(id);
+		} else {
+			dallas_overdrive_skip_rom();
+		}
 	} else {
-		dallas_skip_rom();
+		// A standard speed reset brings back any devices left at overdrive
+		dallas_set_speed(DALLAS_SPEED_STANDARD);
+		if (id && (flags & DALLAS_REQ_RESUME)) {
+			dallas_match_rom_resume(id);
+		} else if (id) {
+			dallas_match_rom(id);
+		} else {
+			dallas_skip_rom();
+		}
 	}
 	if (dallas_bus_error) return dallas_bus_error;
 
 	// Write the request
 	if (flags & DALLAS_REQ_LEN_BITS) {
-		dallas_write_buffer(request, len >> 3);
+		dallas_write_bits(request, len);
 		if (dallas_bus_error) return dallas_bus_error;
-		if (len & 0x07) {
-			cur_byte = request[len >> 3];
-			for (bit_ctr = len & 0x07; bit_ctr; bit_ctr--) {
-				dallas_write(cur_byte & 0x01);
-				if (dallas_bus_error) return dallas_bus_error;
-				cur_byte >>= 1;
-			}
-		}
 	} else {
 		dallas_write_buffer(request, len);
 		if (dallas_bus_error) return dallas_bus_error;
 	}
 
-	// Read the response
-	dallas_read_buffer(response_buf, response_len);
+	// Read the response, accumulating the checksum while it is read
+	if (flags & DALLAS_REQ_EXPECT_CKSUM16) {
+		crc_type = DALLAS_CRC16;
+	} else if (flags & DALLAS_REQ_EXPECT_CKSUM8) {
+		crc_type = DALLAS_CRC8;
+	}
+	if (flags & DALLAS_REQ_RESPONSE_LEN_BITS) {
+		dallas_read_bits(response_buf, response_len);
+		crc_type = 0;
+		flags &= ~DALLAS_REQ_FAIL_ALL_ONES;
+	} else if (crc_type) {
+		dallas_read_buffer_crc(response_buf, response_len, crc_type, &crc);
+	} else {
+		dallas_read_buffer(response_buf, response_len);
+	}
+	if (dallas_bus_error) return dallas_bus_error;
 
 	// Read until 1 if flag is set
 	if (flags & DALLAS_REQ_READ_UNTIL_1) {
@@ -51,26 +166,27 @@ inline uint8_t dallas_request_base(DALLAS_IDENTIFIER_t * id, uint16_t flags, uin
 			if (response_buf[cur_byte] != 0xff) break;
 		}
 		if (cur_byte == response_len) {
-			return 0xC0;
+			return DALLAS_ERR_ALL_ONES;
 		}
 	}
 
-	// Validate checksums
-	if (flags & DALLAS_REQ_EXPECT_CKSUM8) {
+	// Validate checksums (already computed over the raw bytes as they were read)
+	if (crc_type == DALLAS_CRC8) {
 		if (flags & DALLAS_REQ_CKSUM_INVERTED) {
 			response_buf[response_len - 1] = ~(response_buf[response_len - 1]);
+			crc ^= MCRC8_INVERTED_RESIDUE;
 		}
-		if (mcrc8_push_buf(0, response_buf, response_len)) {
-			return 0xC1;
+		if (crc) {
+			return DALLAS_ERR_CRC;
 		}
-	}
-	if (flags & DALLAS_REQ_EXPECT_CKSUM16) {
+	} else if (crc_type == DALLAS_CRC16) {
 		if (flags & DALLAS_REQ_CKSUM_INVERTED) {
 			response_buf[response_len - 1] = ~(response_buf[response_len - 1]);
 			response_buf[response_len - 2] = ~(response_buf[response_len - 2]);
+			crc ^= MCRC16_INVERTED_RESIDUE;
 		}
-		if (mcrc16_push_buf(0, response_buf, response_len)) {
-			return 0xC1;
+		if (crc) {
+			return DALLAS_ERR_CRC;
 		}
 	}
 
@@ -78,45 +194,103 @@ inline uint8_t dallas_request_base(DALLAS_IDENTIFIER_t * id, uint16_t flags, uin
 	return 0;
 }
 
-uint8_t dallas_request(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
-	uint8_t retry_ctr = 0;
+static inline uint8_t request_retry(DALLAS_RETRY_POLICY_t * policy, DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
+	uint8_t attempt = 0;
 	uint8_t cur_res;
-	uint8_t i;
+	uint16_t delay;
+
+	// Carry on from a pending retry of the same request
+	if (retry_pending_attempt && id == retry_pending_id && request == retry_pending_request) {
+		attempt = retry_pending_attempt;
+	}
+	retry_pending_attempt = 0;
+
 	for (;;) {
 		cur_res = 0;
 		if (!dallas_bus_error) {
 			cur_res = dallas_request_base(id, flags, len, request, response_len, response_buf);
 		}
-		if (cur_res || dallas_bus_error) {
-			retry_ctr++;
-			if (retry_ctr > NUM_RETRIES || !(flags & DALLAS_REQ_RETRY)) {
-				if (dallas_bus_error) {
-					return dallas_bus_error;
-				} else {
-					return cur_res;
-				}
-			}
+		if (!cur_res && !dallas_bus_error) {
+			count_attempt(attempt, 0);
 			if (flags & DALLAS_REQ_TXN) {
-				dallas_end_txn();
-			}
-			_delay_ms(RETRY_INITIAL_DELAY);
-			for (i = 0; i < retry_ctr; ++i) {
-				_delay_ms(RETRY_DELAY_BACKOFF);
+				dallas_hold_txn();
 			}
-			retry_ctr++;
-			if (flags & DALLAS_REQ_TXN) {
-				dallas_begin_txn();
+			return 0;
+		}
+		if (dallas_bus_error) {
+			cur_res = dallas_bus_error;
+		}
+		count_attempt(attempt, cur_res);
+
+		// Don't trust RESUME after a failure
+		dallas_forget_selected();
+		attempt++;
+		if (!(flags & DALLAS_REQ_RETRY) || attempt > policy->max_retries) {
+			return cur_res;
+		}
+		delay = policy->backoff ? policy->backoff(cur_res, attempt) : 0;
+		if (delay == DALLAS_RETRY_STOP) {
+			return cur_res;
+		}
+
+		if (delay && !policy->wait) {
+			// Don't block for the backoff: hand it back to the caller.  Inside a
+			// transaction the bus error is left set, so the caller lets go of the
+			// bus while it waits.
+			retry_pending_id = id;
+			retry_pending_request = request;
+			retry_pending_attempt = attempt;
+			dallas_retry_wait_us = delay;
+			if (!(flags & DALLAS_REQ_TXN)) {
+				dallas_bus_error = 0;
 			}
-		} else {
+			return DALLAS_ERR_RETRY_PENDING;
+		}
+
+		if (cur_res == DALLAS_ERR_ALL_ONES || cur_res == DALLAS_ERR_CRC) {
+			// The bus is fine, so keep it for the retry
 			if (flags & DALLAS_REQ_TXN) {
 				dallas_hold_txn();
 			}
-			return 0;
+			if (delay) policy->wait(delay);
+		} else if (flags & DALLAS_REQ_TXN) {
+			// Let go of the bus while backing off, then arbitrate for it again
+			dallas_end_txn();
+			if (delay) policy->wait(delay);
+			dallas_begin_txn();
+		} else {
+			if (delay) policy->wait(delay);
+			dallas_bus_error = 0;
 		}
 	}
 }
 
+uint8_t dallas_request_retry(DALLAS_RETRY_POLICY_t * policy, DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
+#if DALLAS_DEVICE_STATS_LEN > 0
+	uint8_t res;
+#ifdef DALLAS_STATS_CLOCK
+	uint16_t start = DALLAS_STATS_CLOCK();
+#endif
+	request_stats = id ? device_stats_add(id) : 0;
+	res = request_retry(policy, id, flags, len, request, response_len, response_buf);
+#ifdef DALLAS_STATS_CLOCK
+	// Unsigned arithmetic handles the clock wrapping (once)
+	if (request_stats) request_stats->bus_time += (uint16_t)(DALLAS_STATS_CLOCK() - start);
+#endif
+	request_stats = 0;
+	return res;
+#else
+	return request_retry(policy, id, flags, len, request, response_len, response_buf);
+#endif
+}
+
+uint8_t dallas_request(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
+	return dallas_request_retry(dallas_retry_policy, id, flags, len, request, response_len, response_buf);
+}
+
 uint8_t dallas_request_txn(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf) {
+	// Another master may have selected something else since our last transaction
+	dallas_forget_selected();
 	dallas_begin_txn();
 	if (dallas_bus_error) {
 		dallas_end_txn();
@@ -126,3 +300,34 @@ uint8_t dallas_request_txn(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len
 	dallas_end_txn();
 	return res;
 }
+
+uint8_t dallas_request_batch(DALLAS_REQUEST_t * requests, uint8_t num_requests) {
+	uint8_t i;
+	uint8_t num_failed = 0;
+	// Set once a transaction couldn't be started
+	uint8_t txn_error;
+	DALLAS_REQUEST_t * req;
+
+	// Another master may have selected something else since our last transaction
+	dallas_forget_selected();
+	dallas_begin_txn();
+	txn_error = dallas_bus_error;
+	for (i = 0; i < num_requests; i++) {
+		req = &requests[i];
+		if (!txn_error && dallas_bus_error) {
+			// Start over with a fresh transaction
+			dallas_end_txn();
+			dallas_begin_txn();
+			txn_error = dallas_bus_error;
+		}
+		if (txn_error) {
+			// Don't wait out the arbitration timeout again for every request
+			req->result = txn_error;
+		} else {
+			req->result = dallas_request(req->id, req->flags | DALLAS_REQ_TXN, req->len, req->request, req->response_len, req->response_buf);
+		}
+		if (req->result) num_failed++;
+	}
+	dallas_end_txn();
+	return num_failed;
+}
@@ -20,12 +20,138 @@
 #define DALLAS_REQ_FAIL_ALL_ONES 0x40
 // Invert the checksum before checking
 #define DALLAS_REQ_CKSUM_INVERTED 0x80
+// Address the device with OVERDRIVE MATCH ROM / OVERDRIVE SKIP ROM and run the
+// rest of the request at overdrive speed
+#define DALLAS_REQ_OVERDRIVE 0x100
+// The device supports RESUME.  If it was the last device selected, select it with
+// RESUME instead of MATCH ROM.
+#define DALLAS_REQ_RESUME 0x200
+// The 'response_len' parameter is specified in bits.  The checksum and all 1's
+// checks are not supported.
+#define DALLAS_REQ_RESPONSE_LEN_BITS 0x400
 
-// Sends a "request" to a slave device.  Returns zero on success.
+/*** RESULTS ***/
+// Besides 0 (success) and the DALLAS_ERR_* bus errors, requests can fail with...
+// The response was all 1's (with DALLAS_REQ_FAIL_ALL_ONES)
+#define DALLAS_ERR_ALL_ONES 0xC0
+// The response checksum was wrong
+#define DALLAS_ERR_CRC 0xC1
+// The request failed and should be retried after dallas_retry_wait_us (with
+// DALLAS_REQ_RETRY and a policy without a wait hook, such as the default).  Call
+// it again with the same id and request buffer to carry on from the same attempt
+// count.
+#define DALLAS_ERR_RETRY_PENDING 0xC2
+
+/*** RETRY POLICY ***/
+// Default maximum number of retries
+#ifndef DALLAS_RETRY_MAX
+#define DALLAS_RETRY_MAX 5
+#endif
+
+// Returned by a backoff function to stop retrying
+#define DALLAS_RETRY_STOP 0xFFFF
+
+// Decides how requests with DALLAS_REQ_RETRY are retried.
+typedef struct {
+	// Maximum number of retries per call
+	uint8_t max_retries;
+	// Called with the failed attempt's result (a DALLAS_ERR_* code) and
+	// the number of attempts so far.  Returns how many microseconds to wait
+	// before retrying, or DALLAS_RETRY_STOP .  If null, retries right away.
+	uint16_t (*backoff)(uint8_t result, uint8_t attempt);
+	// Called to wait before a retry, ie to run other work meanwhile.  If null,
+	// the request doesn't block: a retry that needs a backoff returns
+	// DALLAS_ERR_RETRY_PENDING, and the caller waits dallas_retry_wait_us before
+	// calling it again.  Retries with no backoff run right away either way.
+	void (*wait)(uint16_t us);
+} DALLAS_RETRY_POLICY_t;
+
+// After DALLAS_ERR_RETRY_PENDING, how many microseconds to wait before calling
+// the request again
+extern uint16_t dallas_retry_wait_us;
+
+// The default backoff.  Retries crc failures and all 1's right away, backs off
+// bus errors exponentially from 100 us up to 6.4 ms, and stops on
+// DALLAS_ERR_UNSUPPORTED.  The default policy has no wait hook, so bus error
+// retries come back as DALLAS_ERR_RETRY_PENDING instead of busy-waiting.
+uint16_t dallas_retry_default_backoff(uint8_t result, uint8_t attempt);
+
+// Sets the policy used by dallas_request().  Null restores the default.
+void dallas_set_retry_policy(DALLAS_RETRY_POLICY_t * policy);
+
+// Sends a "request" to a slave device.  Returns zero on success, or a DALLAS_ERR_*
+// code.
 // If id is null, does a skip rom
 uint8_t dallas_request(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf);
 
+// Same as dallas_request(), with the given retry policy for just this call
+uint8_t dallas_request_retry(DALLAS_RETRY_POLICY_t * policy, DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf);
+
 // Performs the request inside of a new transaction
 uint8_t dallas_request_txn(DALLAS_IDENTIFIER_t * id, uint16_t flags, uint8_t len, uint8_t * request, uint8_t response_len, uint8_t * response_buf);
 
+// One request of a batch.  The fields are the arguments of dallas_request() .
+typedef struct {
+	DALLAS_IDENTIFIER_t * id;
+	uint16_t flags;
+	uint8_t len;
+	uint8_t * request;
+	uint8_t response_len;
+	uint8_t * response_buf;
+	// Set to what dallas_request() returned
+	uint8_t result;
+} DALLAS_REQUEST_t;
+
+// Performs the requests in order inside of one transaction, so the bus is only
+// arbitrated for once.  Requests with DALLAS_REQ_RESUME that address the same
+// device as the one before use RESUME.  If a request leaves a bus error, the
+// transaction is restarted before the next one.  If a transaction can't be
+// started, the rest of the requests fail with that error without being sent.
+// A request that needs a backoff fails with DALLAS_ERR_RETRY_PENDING (see
+// DALLAS_RETRY_POLICY_t), and can be sent again after dallas_retry_wait_us.
+// Returns the number of requests that failed.
+uint8_t dallas_request_batch(DALLAS_REQUEST_t * requests, uint8_t num_requests);
+
+/*** PER-DEVICE STATISTICS ***/
+// Number of devices that dallas_request() keeps statistics for.  0 turns them
+// off.  Each device takes sizeof(DALLAS_DEVICE_STATS_t) (21) bytes.
+#ifndef DALLAS_DEVICE_STATS_LEN
+#define DALLAS_DEVICE_STATS_LEN 0
+#endif
+
+#if DALLAS_DEVICE_STATS_LEN > 0
+
+typedef struct {
+	DALLAS_IDENTIFIER_t id;
+	// Attempts (including retries) at requests to the device
+	uint16_t attempts;
+	// Attempts that were retries
+	uint16_t retries;
+	// Attempts that failed with DALLAS_ERR_CRC or DALLAS_ERR_ALL_ONES
+	uint16_t crc_failures;
+	// Attempts that failed with a bus error
+	uint16_t bus_errors;
+	// Result of the last attempt
+	uint8_t last_error;
+	// Time spent in requests to the device, including retries and backoff, in
+	// DALLAS_STATS_CLOCK() ticks.  Stays 0 if DALLAS_STATS_CLOCK isn't defined.
+	uint32_t bus_time;
+} DALLAS_DEVICE_STATS_t;
+
+// Returns the statistics of a device, or null if it hasn't been addressed since
+// the last clear.  Devices are tracked in the order they are first addressed,
+// until DALLAS_DEVICE_STATS_LEN are.  Skip rom requests aren't tracked.
+DALLAS_DEVICE_STATS_t * dallas_get_device_stats(DALLAS_IDENTIFIER_t * id);
+
+// Returns the number of tracked devices.
+uint8_t dallas_device_stats_count(void);
+
+// Returns the statistics of the i'th tracked device.
+DALLAS_DEVICE_STATS_t * dallas_device_stats_at(uint8_t i);
+
+// Forgets all devices and their statistics.
+void dallas_clear_device_stats(void);
+
+#endif
+
 #endif
@@ -0,0 +1,92 @@
+#ifndef ONE_WIRE_TRACE_H
+#define ONE_WIRE_TRACE_H
+
+#include <stdint.h>
+
+// Timeslot trace for profiling the bus
+
+/*
+The master and the slave can each record every reset and slot they take part in
+into a ring buffer in SRAM, to see what the bus is really doing without a logic
+analyzer.  Define DALLAS_TRACE (master) and/or OWS_TRACE (slave) in
+one_wire_conf.h to turn it on.  Otherwise none of this is compiled in.
+
+Each record holds:
+- time: OW_TRACE_CLOCK() when the slot ended.  Define it as any free-running
+  counter (ie, TCNT1).  Without it, time is always 0.
+- type: OW_TRACE_RESET, OW_TRACE_WRITE (a bit sent by the master), or
+  OW_TRACE_READ (a bit sent by a slave), with OW_TRACE_ERROR set if the slot
+  failed.
+- value: the bit (or presence, for a reset), or the error code if the slot
+  failed (dallas_bus_error on the master, ows_error_flag on the slave).
+- recovery: how long the bus took to come back up after it was last released in
+  the slot, in poll loop iterations (DELAY_POLL_CYCLES cycles each), up to 255.
+  0 means it was already up.
+
+Recording a slot costs a few dozen cycles, outside the timed part of the slot.
+Once the buffer is full, the oldest records are overwritten.
+*/
+
+// Number of records.  Must be a power of 2, at most 128.  Each record takes 5
+// bytes.
+#ifndef OW_TRACE_LEN
+#define OW_TRACE_LEN 16
+#endif
+
+#if OW_TRACE_LEN < 2 || OW_TRACE_LEN > 128 || (OW_TRACE_LEN & (OW_TRACE_LEN - 1))
+#error "OW_TRACE_LEN must be a power of 2 between 2 and 128"
+#endif
+
+#ifndef OW_TRACE_CLOCK
+#define OW_TRACE_CLOCK() 0
+#endif
+
+// Record types
+#define OW_TRACE_RESET 1
+#define OW_TRACE_WRITE 2
+#define OW_TRACE_READ 3
+// Set in the type if the slot failed
+#define OW_TRACE_ERROR 0x80
+
+typedef struct {
+	uint16_t time;
+	uint8_t type;
+	uint8_t value;
+	uint8_t recovery;
+} OW_TRACE_RECORD_t;
+
+typedef struct {
+	OW_TRACE_RECORD_t records[OW_TRACE_LEN];
+	// Where the next record goes
+	uint8_t next;
+	// Set once the buffer has filled up
+	uint8_t wrapped;
+} OW_TRACE_t;
+
+static inline void ow_trace_record(OW_TRACE_t * trace, uint8_t type, uint8_t value, uint16_t recovery) {
+	OW_TRACE_RECORD_t * record = &trace->records[trace->next];
+	record->time = OW_TRACE_CLOCK();
+	record->type = type;
+	record->value = value;
+	record->recovery = (recovery > 0xFF) ? 0xFF : recovery;
+	trace->next = (trace->next + 1) & (OW_TRACE_LEN - 1);
+	if (!trace->next) trace->wrapped = 1;
+}
+
+static inline void ow_trace_clear(OW_TRACE_t * trace) {
+	trace->next = 0;
+	trace->wrapped = 0;
+}
+
+// Returns the number of records in the buffer
+static inline uint8_t ow_trace_count(OW_TRACE_t * trace) {
+	return trace->wrapped ? OW_TRACE_LEN : trace->next;
+}
+
+// Returns the i'th record, oldest first
+static inline OW_TRACE_RECORD_t * ow_trace_get(OW_TRACE_t * trace, uint8_t i) {
+	if (trace->wrapped) i = (trace->next + i) & (OW_TRACE_LEN - 1);
+	return &trace->records[i];
+}
+
+#endif
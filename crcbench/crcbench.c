@@ -0,0 +1,243 @@
+// Host-native benchmark and cross-check for maxim_crc.h
+//
+// Every engine is compiled in (MCRC_ALL_ENGINES) and checked against the bitwise
+// engine over known Maxim vectors and a large number of random buffers.  The
+// mcrc*_push_buf routines use whichever engine MCRC_MODE selects.
+//
+// Returns nonzero if any result differs from the bitwise reference.
+
+#define MCRC_ALL_ENGINES
+#include "./maxim_crc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Number of random buffers to cross-check
+#define NUM_RANDOM_BUFS 2000000
+// Max length of each random buffer
+#define RANDOM_BUF_MAX_LEN 64
+// Number of bytes pushed through each engine when timing
+#define BENCH_BYTES (64UL * 1024UL * 1024UL)
+
+#if MCRC_MODE == MCRC_MODE_TABLE
+#define MCRC_MODE_NAME "table"
+#elif MCRC_MODE == MCRC_MODE_NIBBLE
+#define MCRC_MODE_NAME "nibble"
+#else
+#define MCRC_MODE_NAME "bitwise"
+#endif
+
+uint32_t num_failures = 0;
+
+// xorshift32, so runs are repeatable
+uint32_t rng_state = 0x1f2e3d4c;
+uint8_t rng_byte() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return (uint8_t)(rng_state >> 11);
+}
+
+double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+void fail(const char * what, const char * name, uint16_t got, uint16_t expected) {
+	printf("MISMATCH %s %s: got %04x expected %04x\n", what, name, got, expected);
+	num_failures++;
+}
+
+/*** Reference (bitwise) buffer routines ***/
+
+uint8_t ref_crc8(uint8_t crc, uint8_t * buf, uint8_t len) {
+	while (len--) crc = mcrc8_push_byte_bitwise(crc, *buf++);
+	return crc;
+}
+
+uint16_t ref_crc16(uint16_t crc, uint8_t * buf, uint8_t len) {
+	while (len--) crc = mcrc16_push_byte_bitwise(crc, *buf++);
+	return crc;
+}
+
+// Runs every crc8 engine over buf and compares against the reference
+void check_crc8(const char * name, uint8_t * buf, uint8_t len) {
+	uint8_t ref = ref_crc8(0, buf, len);
+	uint8_t crc;
+	uint8_t i, bit;
+
+	crc = 0;
+	for (i = 0; i < len; i++) crc = mcrc8_push_byte_nibble(crc, buf[i]);
+	if (crc != ref) fail("crc8 nibble", name, crc, ref);
+
+	crc = 0;
+	for (i = 0; i < len; i++) crc = mcrc8_push_byte_table(crc, buf[i]);
+	if (crc != ref) fail("crc8 table", name, crc, ref);
+
+	crc = 0;
+	for (i = 0; i < len; i++) {
+		for (bit = 0; bit < 8; bit++) crc = mcrc8_push_bit(crc, (buf[i] >> bit) & 0x01);
+	}
+	if (crc != ref) fail("crc8 bit", name, crc, ref);
+
+	crc = mcrc8_push_buf(0, buf, len);
+	if (crc != ref) fail("crc8 push_buf (" MCRC_MODE_NAME ")", name, crc, ref);
+
+	// Appending the crc must validate to zero
+	if (mcrc8_push_byte(ref, ref) != 0) fail("crc8 validate", name, mcrc8_push_byte(ref, ref), 0);
+}
+
+void check_crc16(const char * name, uint8_t * buf, uint8_t len) {
+	uint16_t ref = ref_crc16(0, buf, len);
+	uint16_t crc;
+	uint8_t i, bit;
+
+	crc = 0;
+	for (i = 0; i < len; i++) crc = mcrc16_push_byte_nibble(crc, buf[i]);
+	if (crc != ref) fail("crc16 nibble", name, crc, ref);
+
+	crc = 0;
+	for (i = 0; i < len; i++) crc = mcrc16_push_byte_table(crc, buf[i]);
+	if (crc != ref) fail("crc16 table", name, crc, ref);
+
+	crc = 0;
+	for (i = 0; i < len; i++) {
+		for (bit = 0; bit < 8; bit++) crc = mcrc16_push_bit(crc, (buf[i] >> bit) & 0x01);
+	}
+	if (crc != ref) fail("crc16 bit", name, crc, ref);
+
+	crc = mcrc16_push_buf(0, buf, len);
+	if (crc != ref) fail("crc16 push_buf (" MCRC_MODE_NAME ")", name, crc, ref);
+
+	// Appending the crc (lsb first) must validate to zero, and appending it
+	// inverted must end at the inverted residue
+	crc = mcrc16_push_byte(mcrc16_push_byte(ref, ref & 0xFF), ref >> 8);
+	if (crc != 0) fail("crc16 validate", name, crc, 0);
+	crc = mcrc16_push_byte(mcrc16_push_byte(ref, ~ref & 0xFF), (~ref >> 8) & 0xFF);
+	if (crc != MCRC16_INVERTED_RESIDUE) fail("crc16 inverted residue", name, crc, MCRC16_INVERTED_RESIDUE);
+}
+
+/*** Known vectors ***/
+
+typedef struct {
+	const char * name;
+	uint8_t len;
+	uint8_t data[16];
+	uint16_t expected;
+} crc_vector_t;
+
+// crc8 over all bytes except the last must equal the last byte
+crc_vector_t crc8_vectors[] = {
+	// Example ROM from Maxim application note 27
+	{ "rom an27", 8, { 0x02, 0x1C, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xA2 }, 0xA2 },
+	// DS18B20 ROM
+	{ "rom ds18b20", 8, { 0x28, 0xB4, 0xC5, 0xB0, 0x06, 0x00, 0x00, 0x75 }, 0x75 },
+	// DS18B20 scratchpad at power-on (+85C)
+	{ "scratchpad 85c", 9, { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0x1C }, 0x1C },
+	// DS18B20 scratchpad at +25.0625C
+	{ "scratchpad 25c", 9, { 0x91, 0x01, 0x4B, 0x46, 0x7F, 0xFF, 0x0F, 0x10, 0x25 }, 0x25 },
+	// Standard check string
+	{ "check string", 10, { '1', '2', '3', '4', '5', '6', '7', '8', '9', 0xA1 }, 0xA1 },
+};
+
+// crc16 over all bytes must equal expected
+crc_vector_t crc16_vectors[] = {
+	// Standard check string
+	{ "check string", 9, { '1', '2', '3', '4', '5', '6', '7', '8', '9' }, 0xBB3D },
+	// Read memory command header (F0 00 00)
+	{ "read memory", 3, { 0xF0, 0x00, 0x00 }, 0x3300 },
+};
+
+void check_vectors() {
+	uint8_t i;
+	uint16_t crc;
+	crc_vector_t * v;
+	for (i = 0; i < sizeof(crc8_vectors) / sizeof(crc8_vectors[0]); i++) {
+		v = &crc8_vectors[i];
+		crc = ref_crc8(0, v->data, v->len - 1);
+		if (crc != v->expected) fail("crc8 vector", v->name, crc, v->expected);
+		if (ref_crc8(0, v->data, v->len) != 0) fail("crc8 vector validate", v->name, ref_crc8(0, v->data, v->len), 0);
+		check_crc8(v->name, v->data, v->len);
+	}
+	for (i = 0; i < sizeof(crc16_vectors) / sizeof(crc16_vectors[0]); i++) {
+		v = &crc16_vectors[i];
+		crc = ref_crc16(0, v->data, v->len);
+		if (crc != v->expected) fail("crc16 vector", v->name, crc, v->expected);
+		check_crc16(v->name, v->data, v->len);
+	}
+}
+
+void check_random() {
+	uint8_t buf[RANDOM_BUF_MAX_LEN];
+	uint32_t n;
+	uint8_t len, i;
+	for (n = 0; n < NUM_RANDOM_BUFS; n++) {
+		len = rng_byte() % (RANDOM_BUF_MAX_LEN + 1);
+		for (i = 0; i < len; i++) buf[i] = rng_byte();
+		check_crc8("random", buf, len);
+		check_crc16("random", buf, len);
+		if (num_failures > 20) return;
+	}
+}
+
+/*** Timing ***/
+
+// The buffer size matches the largest response dallas_request_base usually sees
+#define BENCH_BUF_LEN 9
+uint8_t bench_buf[BENCH_BUF_LEN];
+volatile uint16_t bench_sink;
+
+#define BENCH_LOOP(name, type, push) do { \
+		type crc = 0; \
+		uint32_t n; \
+		uint8_t i; \
+		double start = now_ns(); \
+		for (n = 0; n < BENCH_BYTES / BENCH_BUF_LEN; n++) { \
+			bench_buf[0] = (uint8_t)n; \
+			for (i = 0; i < BENCH_BUF_LEN; i++) crc = push(crc, bench_buf[i]); \
+		} \
+		bench_sink = crc; \
+		printf("%-24s %8.3f ns/byte\n", name, (now_ns() - start) / (double)(n * BENCH_BUF_LEN)); \
+	} while (0)
+
+#define BENCH_BUF(name, type, push_buf) do { \
+		type crc = 0; \
+		uint32_t n; \
+		double start = now_ns(); \
+		for (n = 0; n < BENCH_BYTES / BENCH_BUF_LEN; n++) { \
+			bench_buf[0] = (uint8_t)n; \
+			crc = push_buf(crc, bench_buf, BENCH_BUF_LEN); \
+		} \
+		bench_sink = crc; \
+		printf("%-24s %8.3f ns/byte\n", name, (now_ns() - start) / (double)(n * BENCH_BUF_LEN)); \
+	} while (0)
+
+void run_benchmarks() {
+	uint8_t i;
+	for (i = 0; i < BENCH_BUF_LEN; i++) bench_buf[i] = rng_byte();
+	BENCH_LOOP("mcrc8 bitwise", uint8_t, mcrc8_push_byte_bitwise);
+	BENCH_LOOP("mcrc8 nibble", uint8_t, mcrc8_push_byte_nibble);
+	BENCH_LOOP("mcrc8 table", uint8_t, mcrc8_push_byte_table);
+	BENCH_BUF("mcrc8_push_buf (" MCRC_MODE_NAME ")", uint8_t, mcrc8_push_buf);
+	BENCH_LOOP("mcrc16 bitwise", uint16_t, mcrc16_push_byte_bitwise);
+	BENCH_LOOP("mcrc16 nibble", uint16_t, mcrc16_push_byte_nibble);
+	BENCH_LOOP("mcrc16 table", uint16_t, mcrc16_push_byte_table);
+	BENCH_BUF("mcrc16_push_buf (" MCRC_MODE_NAME ")", uint16_t, mcrc16_push_buf);
+}
+
+int main(int argc, char ** argv) {
+	printf("MCRC_MODE: %s\n", MCRC_MODE_NAME);
+	check_vectors();
+	check_random();
+	if (num_failures) {
+		printf("%lu mismatches\n", (unsigned long)num_failures);
+		return 1;
+	}
+	printf("All engines match the bitwise reference (%d random buffers)\n", NUM_RANDOM_BUFS);
+	if (argc < 2 || strcmp(argv[1], "-n")) {
+		run_benchmarks();
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Compact store of device identifiers.  See dallas_id_store.h .
+ */
+
+#include <stdint.h>
+
+#include "dallas_id_store.h"
+#include "maxim_crc.h"
+
+DALLAS_ID_STORE_t id_store;
+
+// Compares an entry against a family index and serial.  Returns <0, 0, or >0
+// like memcmp.
+int8_t id_store_compare(DALLAS_ID_STORE_ENTRY_t * entry, uint8_t family_index, uint8_t * serial) {
+	uint8_t i;
+	if (entry->family_index != family_index) {
+		return (entry->family_index < family_index) ? -1 : 1;
+	}
+	// The high bytes of a serial vary the least, so compare them first
+	for (i = DALLAS_ID_SERIAL_LEN; i > 0; i--) {
+		if (entry->serial[i - 1] != serial[i - 1]) {
+			return (entry->serial[i - 1] < serial[i - 1]) ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+// Binary search for a family index and serial.  Returns the slot if found, or
+// the slot it would be inserted at otherwise.  found is set to 1 if it was found.
+uint8_t id_store_search(uint8_t family_index, uint8_t * serial, uint8_t * found) {
+	uint8_t low = 0;
+	uint8_t high = id_store.num_entries;
+	uint8_t mid;
+	int8_t cmp;
+
+	*found = 0;
+	while (low < high) {
+		mid = (low + high) >> 1;
+		cmp = id_store_compare(&id_store.entries[mid], family_index, serial);
+		if (cmp == 0) {
+			*found = 1;
+			return mid;
+		} else if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+// Returns the index of a family code, or DALLAS_ID_STORE_FAMILIES if it isn't in
+// the table
+uint8_t id_store_family_index(uint8_t family) {
+	uint8_t i;
+	for (i = 0; i < id_store.num_families; i++) {
+		if (id_store.families[i] == family) return i;
+	}
+	return DALLAS_ID_STORE_FAMILIES;
+}
+
+void dallas_id_store_clear(void) {
+	id_store.num_families = 0;
+	id_store.num_entries = 0;
+}
+
+uint8_t dallas_id_store_add(DALLAS_IDENTIFIER_t * identifier) {
+	uint8_t family_index;
+	uint8_t slot;
+	uint8_t found;
+	uint8_t i;
+	uint8_t * serial = &identifier->identifier[1];
+
+	if (mcrc8_push_buf(0, identifier->identifier, DALLAS_NUM_IDENTIFIER_BITS / 8)) return 1;
+
+	family_index = id_store_family_index(identifier->identifier[0]);
+	if (family_index == DALLAS_ID_STORE_FAMILIES) {
+		// New family.  Check for room before adding it to the table.
+		if (id_store.num_entries >= DALLAS_ID_STORE_LEN) return 2;
+		if (id_store.num_families >= DALLAS_ID_STORE_FAMILIES) return 3;
+		family_index = id_store.num_families++;
+		id_store.families[family_index] = identifier->identifier[0];
+		slot = id_store_search(family_index, serial, &found);
+	} else {
+		slot = id_store_search(family_index, serial, &found);
+		if (found) return 0;
+		if (id_store.num_entries >= DALLAS_ID_STORE_LEN) return 2;
+	}
+
+	// Shift the later entries up to make room
+	for (i = id_store.num_entries; i > slot; i--) {
+		id_store.entries[i] = id_store.entries[i - 1];
+	}
+	id_store.entries[slot].family_index = family_index;
+	for (i = 0; i < DALLAS_ID_SERIAL_LEN; i++) {
+		id_store.entries[slot].serial[i] = serial[i];
+	}
+	id_store.num_entries++;
+	return 0;
+}
+
+uint8_t dallas_id_store_find(DALLAS_IDENTIFIER_t * identifier) {
+	uint8_t family_index;
+	uint8_t slot;
+	uint8_t found;
+
+	family_index = id_store_family_index(identifier->identifier[0]);
+	if (family_index == DALLAS_ID_STORE_FAMILIES) return DALLAS_ID_STORE_NOT_FOUND;
+	slot = id_store_search(family_index, &identifier->identifier[1], &found);
+	return found ? slot : DALLAS_ID_STORE_NOT_FOUND;
+}
+
+void dallas_id_store_get(uint8_t slot, DALLAS_IDENTIFIER_t * identifier) {
+	uint8_t i;
+	DALLAS_ID_STORE_ENTRY_t * entry = &id_store.entries[slot];
+
+	identifier->identifier[0] = id_store.families[entry->family_index];
+	for (i = 0; i < DALLAS_ID_SERIAL_LEN; i++) {
+		identifier->identifier[i + 1] = entry->serial[i];
+	}
+	identifier->identifier[DALLAS_ID_SERIAL_LEN + 1] = mcrc8_push_buf(0, identifier->identifier, DALLAS_ID_SERIAL_LEN + 1);
+}
+
+uint8_t dallas_id_store_count(void) {
+	return id_store.num_entries;
+}
+
+uint8_t dallas_id_store_search(void) {
+	DALLAS_SEARCH_t search;
+	uint8_t result;
+
+	dallas_id_store_clear();
+	dallas_search_start(&search, SEARCH_ROM_COMMAND, 0, 0);
+	while (1) {
+		result = dallas_search_next(&search);
+		if (result == 2) {
+			return id_store.num_entries ? 0 : 1;
+		}
+		if (result) return result;
+		result = dallas_id_store_add(&search.identifier);
+		// The search already checked the crc
+		if (result == 2) return 2;
+		if (result == 3) return 4;
+	}
+}
+
+DALLAS_ID_STORE_t * get_id_store(void) {
+	return &id_store;
+}
@@ -0,0 +1,78 @@
+/*
+ * Compact store of device identifiers.
+ *
+ * Each entry keeps only the 6 serial bytes of an identifier and an index into a
+ * small table of family codes.  The crc byte is regenerated when an identifier
+ * is read back.  Entries are kept sorted, so finding the slot of an identifier
+ * is a binary search.  At the defaults, 32 devices take 230 bytes instead of
+ * 257 for the same number in DALLAS_IDENTIFIER_LIST_t .
+ *
+ * Slots are indexes into the sorted entries, so adding a device moves the slots
+ * of every device sorted after it.
+ */
+
+#ifndef DALLAS_ID_STORE_H
+#define DALLAS_ID_STORE_H
+
+#include <stdint.h>
+#include "dallas_one_wire.h"
+
+// Maximum number of stored devices (at most 254)
+#ifndef DALLAS_ID_STORE_LEN
+#define DALLAS_ID_STORE_LEN 32
+#endif
+
+// Maximum number of different family codes
+#ifndef DALLAS_ID_STORE_FAMILIES
+#define DALLAS_ID_STORE_FAMILIES 4
+#endif
+
+// Number of serial bytes in an identifier (between the family code and the crc)
+#define DALLAS_ID_SERIAL_LEN 6
+
+// Returned by dallas_id_store_find() when the identifier isn't stored
+#define DALLAS_ID_STORE_NOT_FOUND 0xFF
+
+typedef struct {
+	// Index into DALLAS_ID_STORE_t.families
+	uint8_t family_index;
+	// Serial bytes, in the order they are sent
+	uint8_t serial[DALLAS_ID_SERIAL_LEN];
+} DALLAS_ID_STORE_ENTRY_t;
+
+typedef struct {
+	uint8_t families[DALLAS_ID_STORE_FAMILIES];
+	uint8_t num_families;
+	// Sorted by family_index, then by serial (compared from the last byte)
+	DALLAS_ID_STORE_ENTRY_t entries[DALLAS_ID_STORE_LEN];
+	uint8_t num_entries;
+} DALLAS_ID_STORE_t;
+
+// Empties the store.
+void dallas_id_store_clear(void);
+
+// Adds an identifier.  Adding one that is already stored does nothing.  Returns...
+// 0 - if the identifier is stored
+// 1 - if the identifier's crc is wrong
+// 2 - if the store is full
+// 3 - if there are already DALLAS_ID_STORE_FAMILIES other family codes
+uint8_t dallas_id_store_add(DALLAS_IDENTIFIER_t * identifier);
+
+// Returns the slot holding the identifier, or DALLAS_ID_STORE_NOT_FOUND .
+uint8_t dallas_id_store_find(DALLAS_IDENTIFIER_t * identifier);
+
+// Rebuilds the full identifier (with its crc) of a slot.
+void dallas_id_store_get(uint8_t slot, DALLAS_IDENTIFIER_t * identifier);
+
+// Returns the number of stored identifiers.
+uint8_t dallas_id_store_count(void);
+
+// Empties the store and fills it with a streaming search of the bus.  Returns
+// the same as dallas_search_identifiers(), or 4 if the family table filled up
+// (the store keeps the devices that fit).
+uint8_t dallas_id_store_search(void);
+
+// Returns the store.
+DALLAS_ID_STORE_t * get_id_store(void);
+
+#endif
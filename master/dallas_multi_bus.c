@@ -0,0 +1,182 @@
+/*
+ * Multi-bus master.  See dallas_multi_bus.h .
+ *
+ * The slots are the same as the GPIO backend of the single bus master, except
+ * that recovery is only checked at the end of each slot.  Write slots are as
+ * long as a write 0 slot, so buses writing 0s and 1s can share them.
+ */
+
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "dallas_multi_bus.h"
+
+#include <util/atomic.h>
+#include <util/delay.h>
+
+#ifndef DALLAS_MULTI_PORT
+#error "DALLAS_MULTI_PORT, DALLAS_MULTI_PORT_IN, and DALLAS_MULTI_DDR must be defined in one_wire_conf.h"
+#endif
+
+uint8_t dallas_multi_bus_error = 0;
+
+static inline void multi_set_high(uint8_t mask) {
+	// Set pins as inputs, with the internal pullups disabled
+	DALLAS_MULTI_DDR &= ~mask;
+	DALLAS_MULTI_PORT &= ~mask;
+}
+
+static inline void multi_set_low(uint8_t mask) {
+	DALLAS_MULTI_PORT &= ~mask;
+	DALLAS_MULTI_DDR |= mask;
+}
+
+// Returns the bitmask of the buses in mask that are low
+static inline uint8_t multi_low(uint8_t mask) {
+	return ~DALLAS_MULTI_PORT_IN & mask;
+}
+
+void dallas_multi_setup(uint8_t mask) {
+	multi_set_high(mask);
+}
+
+uint8_t dallas_multi_reset(uint8_t mask) {
+	uint8_t presence;
+
+	dallas_multi_bus_error = 0;
+	multi_set_high(mask);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		multi_set_low(mask);
+		_delay_us(500);
+		multi_set_high(mask);
+
+		// Buses that never come back up are shorted
+		_delay_us(7);
+		dallas_multi_bus_error |= multi_low(mask);
+
+		_delay_us(63);
+		presence = multi_low(mask);
+
+		_delay_us(420);
+		dallas_multi_bus_error |= multi_low(mask);
+	}
+
+	return presence & ~dallas_multi_bus_error;
+}
+
+void dallas_multi_write(uint8_t mask, uint8_t bits) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Make sure the buses are high
+		multi_set_high(mask);
+		dallas_multi_bus_error |= multi_low(mask);
+		mask &= ~dallas_multi_bus_error;
+
+		multi_set_low(mask);
+
+		// Release the buses writing 1s
+		_delay_us(10);
+		multi_set_high(mask & bits);
+
+		// Release the buses writing 0s
+		_delay_us(50);
+		multi_set_high(mask);
+
+		// Let the rest of the time slot expire
+		_delay_us(30);
+		dallas_multi_bus_error |= multi_low(mask);
+	}
+}
+
+uint8_t dallas_multi_read(uint8_t mask) {
+	uint8_t reply;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Make sure the buses are high
+		multi_set_high(mask);
+		dallas_multi_bus_error |= multi_low(mask);
+		mask &= ~dallas_multi_bus_error;
+
+		multi_set_low(mask);
+		_delay_us(2);
+		multi_set_high(mask);
+
+		// Sample all of the buses at once
+		_delay_us(13);
+		reply = DALLAS_MULTI_PORT_IN & mask;
+
+		// Let the rest of the time slot expire
+		_delay_us(45);
+		dallas_multi_bus_error |= multi_low(mask);
+	}
+
+	return reply;
+}
+
+void dallas_multi_write_byte(uint8_t mask, uint8_t byte) {
+	uint8_t i;
+	for (i = 0; i < 8; i++) {
+		dallas_multi_write(mask, (byte & _BV(i)) ? 0xFF : 0x00);
+	}
+}
+
+void dallas_multi_write_bytes(uint8_t mask, uint8_t * bytes) {
+	uint8_t i;
+	uint8_t bus;
+	uint8_t bits;
+
+	for (i = 0; i < 8; i++) {
+		// Gather bit i of every bus's byte into one mask
+		bits = 0;
+		for (bus = 0; bus < DALLAS_MULTI_NUM_BUSES; bus++) {
+			if (bytes[bus] & _BV(i)) bits |= _BV(bus);
+		}
+		dallas_multi_write(mask, bits);
+	}
+}
+
+void dallas_multi_read_bytes(uint8_t mask, uint8_t * bytes) {
+	uint8_t i;
+	uint8_t bus;
+	uint8_t bits;
+
+	for (bus = 0; bus < DALLAS_MULTI_NUM_BUSES; bus++) {
+		bytes[bus] = 0;
+	}
+	for (i = 0; i < 8; i++) {
+		bits = dallas_multi_read(mask);
+		// Spread the sampled bits out to each bus's byte
+		for (bus = 0; bus < DALLAS_MULTI_NUM_BUSES; bus++) {
+			if (bits & _BV(bus)) bytes[bus] |= _BV(i);
+		}
+	}
+}
+
+void dallas_multi_write_buffer(uint8_t mask, uint8_t * buffer, uint8_t buffer_length) {
+	uint8_t i;
+	for (i = 0; i < buffer_length; i++) {
+		dallas_multi_write_byte(mask, buffer[i]);
+	}
+}
+
+void dallas_multi_read_buffer(uint8_t mask, uint8_t * buffer, uint8_t buffer_length) {
+	uint8_t bytes[DALLAS_MULTI_NUM_BUSES];
+	uint8_t i;
+	uint8_t bus;
+
+	for (i = 0; i < buffer_length; i++) {
+		dallas_multi_read_bytes(mask, bytes);
+		for (bus = 0; bus < DALLAS_MULTI_NUM_BUSES; bus++) {
+			buffer[bus * buffer_length + i] = bytes[bus];
+		}
+	}
+}
+
+uint8_t dallas_multi_skip_rom(uint8_t mask) {
+	mask = dallas_multi_reset(mask);
+	if (mask) {
+		dallas_multi_write_byte(mask, SKIP_ROM_COMMAND);
+	}
+	return mask & ~dallas_multi_bus_error;
+}
@@ -0,0 +1,65 @@
+/*
+ * Multi-bus master.  Treats every pin of one port as a separate 1-Wire bus, and
+ * runs the same slot on any set of them at once.  The low pulses of all of the
+ * buses start and end together, and all of them are sampled with one read of
+ * the input register, so resets, SKIP ROM broadcasts, and byte reads and writes
+ * on up to 8 buses take the time of one.
+ *
+ * Buses are selected with a bitmask of pins.  Functions that return a value per
+ * bus either return it as a bitmask (bit n for the bus on pin n) or fill in an
+ * array indexed by pin number.
+ *
+ * DALLAS_MULTI_PORT, DALLAS_MULTI_PORT_IN and DALLAS_MULTI_DDR must be defined in
+ * one_wire_conf.h .  Only standard speed is supported.  This is independent of
+ * the single bus master, which can run on another port.
+ */
+
+#ifndef DALLAS_MULTI_BUS_H
+#define DALLAS_MULTI_BUS_H
+
+#include <stdint.h>
+#include "dallas_one_wire.h"
+
+// Number of buses on a port
+#define DALLAS_MULTI_NUM_BUSES 8
+
+// Bitmask of buses where a bus error occurred.  Cleared by dallas_multi_reset().
+extern uint8_t dallas_multi_bus_error;
+
+// Releases the buses in mask.
+void dallas_multi_setup(uint8_t mask);
+
+// Resets the buses in mask.  Returns a bitmask of the buses where a device
+// indicated presence.
+uint8_t dallas_multi_reset(uint8_t mask);
+
+// Writes bit n of bits to the bus on pin n, for each bus in mask.
+void dallas_multi_write(uint8_t mask, uint8_t bits);
+
+// Reads a bit from each bus in mask.  Returns them as a bitmask.
+uint8_t dallas_multi_read(uint8_t mask);
+
+// Writes the same byte to every bus in mask.
+void dallas_multi_write_byte(uint8_t mask, uint8_t byte);
+
+// Writes bytes[n] to the bus on pin n, for each bus in mask.
+void dallas_multi_write_bytes(uint8_t mask, uint8_t * bytes);
+
+// Reads a byte from each bus in mask into bytes[n] for the bus on pin n.  bytes
+// must have room for DALLAS_MULTI_NUM_BUSES bytes.
+void dallas_multi_read_bytes(uint8_t mask, uint8_t * bytes);
+
+// Writes the same buffer to every bus in mask.
+void dallas_multi_write_buffer(uint8_t mask, uint8_t * buffer, uint8_t buffer_length);
+
+// Reads buffer_length bytes from each bus in mask.  The bytes from the bus on
+// pin n go in buffer[n * buffer_length] to buffer[n * buffer_length +
+// buffer_length - 1], so buffer must hold DALLAS_MULTI_NUM_BUSES * buffer_length
+// bytes.
+void dallas_multi_read_buffer(uint8_t mask, uint8_t * buffer, uint8_t buffer_length);
+
+// Resets the buses in mask and sends SKIP ROM on every bus where a device
+// indicated presence.  Returns the bitmask of those buses.
+uint8_t dallas_multi_skip_rom(uint8_t mask);
+
+#endif
@@ -10,8 +10,9 @@
  * * It is polled, not interrupt-driven. There are several sections of code
  *   that must run for a specific amount of time and have to disable
  *   interrupts globally.
- * * Only the MATCH_ROM, SEARCH_ROM, and SKIP_ROM commands have been
- *   implemented. At this point other commands would be trivial to add.
+ * * Only the MATCH_ROM, SEARCH_ROM, and SKIP_ROM commands (and their
+ *   OVERDRIVE variants) have been implemented. At this point other commands
+ *   would be trivial to add.
  *
  * Directions
  * ----------
@@ -68,9 +69,13 @@
 
 #include "dallas_one_wire.h"
 #include "delay_helpers.h"
+#include "maxim_crc.h"
 
 #include <util/atomic.h>
 #include <util/delay.h>
+#ifdef DALLAS_ID_LIST_EEPROM_ADDR
+#include <avr/eeprom.h>
+#endif
 
 //////////////////////
 // Global variables //
@@ -86,130 +91,290 @@ DALLAS_IDENTIFIER_LIST_t identifier_list;
 #define DALLAS_IDENTIFIER_DONE 0x01
 #define DALLAS_IDENTIFIER_SEARCH_ERROR 0x02
 
+// Set to one of the DALLAS_ERR_* codes when a bus error occurs
+uint8_t dallas_bus_error = 0;
+
+// Speed used for all slots and resets
+uint8_t dallas_speed = DALLAS_SPEED_STANDARD;
+
+// Last device selected with MATCH ROM, for RESUME.  Only valid if
+// selected_valid is set, and only at selected_speed.
+DALLAS_IDENTIFIER_t selected_identifier;
+uint8_t selected_valid = 0;
+uint8_t selected_speed;
+
+#if DALLAS_BACKEND == DALLAS_BACKEND_GPIO
+
+///////////////////////////////
+// GPIO (bit-banged) backend //
+///////////////////////////////
+
 #define pin_is_low() (!(DALLAS_PORT_IN & _BV(DALLAS_PIN)))
 #define pin_is_high() (DALLAS_PORT_IN & _BV(DALLAS_PIN))
 
-inline void set_bus_high() {
+static inline void set_bus_high() {
 	// Set pin as input
 	DALLAS_DDR &= ~_BV(DALLAS_PIN);
 	// Make sure internal pullup is disabled
 	DALLAS_PORT &= ~_BV(DALLAS_PIN);
 }
 
-inline void set_bus_low() {
+static inline void set_bus_low() {
 	// Configure pin as output (should already be low if initialized)
 	DALLAS_DDR |= _BV(DALLAS_PIN);
 	DALLAS_PORT &= ~_BV(DALLAS_PIN);
 }
 
-// This flag is set to 1 when a bus error occurs
-uint8_t dallas_bus_error = 0;
+// Makes sure the bus is high for the duration of the given microseconds (a
+// constant)
+// Returns 0 if the bus is high for the whole time, and 1 if the bus went low
+#define ensure_bus_high(max_us) (DELAY_POLL_UNTIL_CLEAR(DALLAS_PORT_IN, DALLAS_PIN, max_us) ? 0 : 1)
 
-///////////////
-// Functions //
-///////////////
+#ifdef DALLAS_TRACE
+OW_TRACE_t dallas_trace;
+// Poll iterations the bus took to come up in the last recovery window
+uint16_t trace_recovery;
 
-// Makes sure the bus is high for the duration of the given microseconds
-// Returns 0 if the bus is high for the whole time, and 1 if the bus went low
-inline uint8_t ensure_bus_high(uint8_t max_us) {
-	// This loop takes 5 cycles without NOPs (on my compiler)
-	max_us = DELAY_ROUND_UP(max_us, 5);
-	for(;;) {
-		if (pin_is_low()) return 1;
-		//_NOP();
-		//_NOP();
-		//_NOP();
-		//--max_us;
-		DELAY_EXTRA_NOPS(5);
-		max_us -= DELAY_DECR_USECS(5);
-		if (!max_us) return 0;
-	}
+// Records the slot that just finished
+#define trace_slot(type, value) ow_trace_record(&dallas_trace, dallas_bus_error ? (type) | OW_TRACE_ERROR : (type), dallas_bus_error ? dallas_bus_error : (value), trace_recovery)
+
+OW_TRACE_t * get_dallas_trace(void) {
+	return &dallas_trace;
 }
+#else
+#define trace_slot(type, value)
+#endif
+
+// Same as ensure_bus_transition_high(), for a number of poll iterations known at
+// run time
+#ifdef DALLAS_TRACE
+#define ensure_bus_transition_high_n(iterations) DELAY_POLL_SET_ONCE_N_COUNTED(DALLAS_PORT_IN, DALLAS_PIN, iterations, trace_recovery)
+#else
+#define ensure_bus_transition_high_n(iterations) DELAY_POLL_SET_ONCE_N(DALLAS_PORT_IN, DALLAS_PIN, iterations)
+#endif
 
 // Ensures that the bus is already high, or transitions to the high state at most
-// once, for the duration of max_us.  Returns 0 if the bus transitions high at most
-// once.  Returns 1 if the bus transitions back to low, or the bus never transitions
-// high.
-inline uint8_t ensure_bus_transition_high(uint8_t max_us) {
-	max_us = DELAY_ROUND_UP(max_us, 5);
-	// Wait until bus is high
-	// Loop is 5 cycles without padding
-	for(;;) {
-		if (pin_is_high()) break;
-		DELAY_EXTRA_NOPS(5);
-		max_us -= DELAY_DECR_USECS(5);
-		if (!max_us) return 1;
-	}
-	// Ensure the bus does not return low
-	// Loop is 5 cycles without padding
-	for(;;) {
-		if (pin_is_low()) return 1;
-		DELAY_EXTRA_NOPS(5);
-		max_us -= DELAY_DECR_USECS(5);
-		if (!max_us) return 0;
+// once, for the duration of max_us (a constant).  Returns 0 if the bus transitions
+// high at most once.  Returns 1 if the bus never transitions high, or 2 if it
+// transitions back to low.
+#define ensure_bus_transition_high(max_us) ({ \
+		DELAY_ASSERT_POLL(max_us); \
+		ensure_bus_transition_high_n(DELAY_LOOP_ITERATIONS(max_us, DELAY_POLL_CYCLES)); \
+	})
+
+// Sets dallas_bus_error from the result of one of the ensure_bus_transition_high
+// macros.  Evaluates to nonzero if the bus didn't recover.
+#define recovery_failed(result) ({ \
+		uint8_t recovery_result = (result); \
+		if (recovery_result) dallas_bus_error = (recovery_result == 1) ? DALLAS_ERR_SHORT : DALLAS_ERR_EARLY_LOW; \
+		recovery_result; \
+	})
+
+// Cycles spent inside a low pulse by set_bus_low() after the bus goes low
+#define PULSE_OVERHEAD_CYCLES 2
+// Cycles between releasing the bus and sampling it, not counting the delay
+#define SAMPLE_OVERHEAD_CYCLES 3
+
+// The write 1 pulse must end, and read slots must be sampled, within 15 us.
+// These match DALLAS_TIMING_STANDARD_INIT .
+DELAY_ASSERT_BUDGET(10, PULSE_OVERHEAD_CYCLES, write_1_pulse_fits);
+DELAY_ASSERT_BUDGET(2, PULSE_OVERHEAD_CYCLES, read_pulse_fits);
+DELAY_ASSERT_BUDGET(13, SAMPLE_OVERHEAD_CYCLES, read_sample_fits);
+
+// Standard speed timing converted to loop iterations.  Delays are _delay_loop_2()
+// iterations (0 for none), and the *_rest windows are poll loop iterations.
+typedef struct {
+	uint16_t reset_low;
+	uint16_t reset_sample;
+	uint16_t reset_rest;
+	uint16_t write_0_low;
+	uint16_t write_0_rest;
+	uint16_t write_1_low;
+	uint16_t write_1_rest;
+	uint16_t read_low;
+	uint16_t read_sample;
+	uint16_t read_rest;
+} TIMING_LOOPS_t;
+
+// Time after the end of the reset pulse by which the bus must be back up
+#define RESET_RECOVERY_US 7
+
+TIMING_LOOPS_t timing;
+uint8_t timing_set = 0;
+
+// Runs a _delay_loop_2() delay of n iterations, where 0 is no delay
+static inline void timing_delay(uint16_t n) {
+	if (n) _delay_loop_2(n);
+}
+
+uint8_t dallas_set_timing(DALLAS_TIMING_t * t) {
+	// The pulses have to be long enough to cover the instructions inside them, and
+	// the reset sample has to come after the recovery check
+	if (DELAY_US_TO_CYCLES((uint32_t)t->write_1_low) < PULSE_OVERHEAD_CYCLES) return 1;
+	if (DELAY_US_TO_CYCLES((uint32_t)t->read_low) < PULSE_OVERHEAD_CYCLES) return 1;
+	if (DELAY_US_TO_CYCLES((uint32_t)t->read_sample) < SAMPLE_OVERHEAD_CYCLES) return 1;
+	if (t->reset_sample < RESET_RECOVERY_US) return 1;
+	// The longest delay must fit in _delay_loop_2()
+	if (DELAY_US_TO_CYCLES((uint32_t)t->reset_low) > 0xFFFFUL * 4) return 1;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timing.reset_low = DELAY_LOOP_2_ITERATIONS_RUNTIME(t->reset_low, 0);
+		timing.reset_sample = DELAY_LOOP_2_ITERATIONS_RUNTIME(t->reset_sample - RESET_RECOVERY_US, 0);
+		timing.reset_rest = DELAY_POLL_ITERATIONS_RUNTIME(t->reset_rest);
+		timing.write_0_low = DELAY_LOOP_2_ITERATIONS_RUNTIME(t->write_0_low, 0);
+		timing.write_0_rest = DELAY_POLL_ITERATIONS_RUNTIME(t->write_0_rest);
+		timing.write_1_low = DELAY_LOOP_2_ITERATIONS_RUNTIME(t->write_1_low, PULSE_OVERHEAD_CYCLES);
+		timing.write_1_rest = DELAY_POLL_ITERATIONS_RUNTIME(t->write_1_rest);
+		timing.read_low = DELAY_LOOP_2_ITERATIONS_RUNTIME(t->read_low, PULSE_OVERHEAD_CYCLES);
+		timing.read_sample = DELAY_LOOP_2_ITERATIONS_RUNTIME(t->read_sample, SAMPLE_OVERHEAD_CYCLES);
+		timing.read_rest = DELAY_POLL_ITERATIONS_RUNTIME(t->read_rest);
+		timing_set = 1;
+	}
+	return 0;
+}
+
+uint8_t dallas_set_timing_profile(uint8_t profile) {
+	DALLAS_TIMING_t t = DALLAS_TIMING_STANDARD_INIT;
+	if (profile == DALLAS_TIMING_FAST) {
+		t = (DALLAS_TIMING_t)DALLAS_TIMING_FAST_INIT;
+	} else if (profile == DALLAS_TIMING_LONG_LINE) {
+		t = (DALLAS_TIMING_t)DALLAS_TIMING_LONG_LINE_INIT;
 	}
+	return dallas_set_timing(&t);
 }
 
-// Can set dallas_bus_error flag
-void dallas_write(uint8_t bit) {
-	if (bit == 0x00) {
-		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-			// Make sure the bus is high
-			set_bus_high();
-			if (pin_is_low()) { dallas_bus_error = 1; return; }
+// Makes sure the timing has been set before the first slot
+static inline void ensure_timing() {
+	if (!timing_set) dallas_set_timing_profile(DALLAS_TIMING_STANDARD);
+}
 
-			set_bus_low();
+#ifndef DALLAS_BACKEND_NO_OVERDRIVE
 
-			// Wait the required time.
-			_delay_us(60);
+// Overdrive timing is fixed.  The write 1 and read pulses last 1 us, and read
+// slots are sampled 0.5 us after that, within the 2 us the device holds the bus.
+#define OVERDRIVE_PULSE_US 1
+#define OVERDRIVE_SAMPLE_CYCLES (DELAY_US_TO_CYCLES(1) / 2)
 
-			// Release the bus.
-			set_bus_high();
+DELAY_ASSERT_BUDGET(OVERDRIVE_PULSE_US, PULSE_OVERHEAD_CYCLES, overdrive_pulse_fits);
+DELAY_STATIC_ASSERT(OVERDRIVE_SAMPLE_CYCLES >= SAMPLE_OVERHEAD_CYCLES, overdrive_read_sample_fits);
 
-			// Let the rest of the time slot expire.
-			if (ensure_bus_transition_high(30)) { dallas_bus_error = 1; return; }
+// Overdrive versions of the slots.  Same shape as the standard speed ones below,
+// with overdrive timing.
+static inline void dallas_write_overdrive(uint8_t bit) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Make sure the bus is high
+		set_bus_high();
+		if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return; }
+
+		set_bus_low();
+
+		if (bit == 0x00) {
+			_delay_us(8);
+			set_bus_high();
+			if (recovery_failed(ensure_bus_transition_high(3))) return;
+		} else {
+			DELAY_US_MINUS_CYCLES(OVERDRIVE_PULSE_US, PULSE_OVERHEAD_CYCLES);
+			set_bus_high();
+			if (recovery_failed(ensure_bus_transition_high(9))) return;
 		}
 	}
-	else {
-		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-			// Make sure the bus is high
-			set_bus_high();
-			if (pin_is_low()) { dallas_bus_error = 1; return; }
+}
 
-			set_bus_low();
+static inline uint8_t dallas_read_overdrive(void) {
+	uint8_t reply;
 
-			// Wait the required time.
-			_delay_us(10);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Make sure the bus is high
+		DALLAS_DDR &= ~_BV(DALLAS_PIN);
+		if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return 0; }
 
-			// Release the bus.
-			set_bus_high();
+		set_bus_low();
+		DELAY_US_MINUS_CYCLES(OVERDRIVE_PULSE_US, PULSE_OVERHEAD_CYCLES);
+		set_bus_high();
+
+		// Sample within 2 us of the start of the slot
+		__builtin_avr_delay_cycles(OVERDRIVE_SAMPLE_CYCLES - SAMPLE_OVERHEAD_CYCLES);
+		reply = pin_is_high() ? 0x01 : 0x00;
+
+		if (recovery_failed(ensure_bus_transition_high(8))) return 0;
+	}
 
-			// Let the rest of the time slot expire.
-			if (ensure_bus_transition_high(50)) { dallas_bus_error = 1; return; }
+	return reply;
+}
+
+static inline uint8_t dallas_reset_overdrive(void) {
+	uint8_t reply = 0x00;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		set_bus_low();
+		_delay_us(70);
+		set_bus_high();
+
+		if (recovery_failed(ensure_bus_transition_high(2))) return 0;
+
+		_delay_us(8);
+
+		if (pin_is_low()) {
+			reply = 0x01;
 		}
+
+		if (recovery_failed(ensure_bus_transition_high(40))) return 0;
 	}
-	return 0;
+
+	return reply;
 }
 
-// Returns 0 or 1 on success
-// Sets dallas_bus_error flag
-uint8_t dallas_read(void) {
+#else
+
+// Overdrive is compiled out.  A slot at overdrive speed only fails.
+#define dallas_write_overdrive(bit) (dallas_bus_error = DALLAS_ERR_UNSUPPORTED)
+#define dallas_read_overdrive() (dallas_bus_error = DALLAS_ERR_UNSUPPORTED, 0)
+#define dallas_reset_overdrive() (dallas_bus_error = DALLAS_ERR_UNSUPPORTED, 0)
+
+#endif
+
+// Standard speed slots.  The timing must already be set (see ensure_timing()).
+// Can set dallas_bus_error flag
+static inline void write_slot_standard(uint8_t bit) {
+	// Write 0 and write 1 only differ in their timing
+	uint16_t low = bit ? timing.write_1_low : timing.write_0_low;
+	uint16_t rest = bit ? timing.write_1_rest : timing.write_0_rest;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Make sure the bus is high
+		set_bus_high();
+		if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return; }
+
+		set_bus_low();
+
+		// Wait the required time.
+		timing_delay(low);
+
+		// Release the bus.
+		set_bus_high();
+
+		// Let the rest of the time slot expire.
+		if (recovery_failed(ensure_bus_transition_high_n(rest))) return;
+	}
+}
+
+static inline uint8_t read_slot_standard(void) {
 	uint8_t reply;
 
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		// Make sure the bus is high
 		DALLAS_DDR &= ~_BV(DALLAS_PIN);
-		if (pin_is_low()) { dallas_bus_error = 1; return 0; }
+		if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return 0; }
 
 		set_bus_low();
 
 		// Wait the required time.
-		_delay_us(2);
+		timing_delay(timing.read_low);
 
 		set_bus_high();
 
 		// Wait for a bit.
-		_delay_us(13);
+		timing_delay(timing.read_sample);
 
 		if ((DALLAS_PORT_IN & _BV(DALLAS_PIN)) == 0x00) {
 			reply = 0x00;
@@ -219,28 +384,35 @@ uint8_t dallas_read(void) {
 		}
 
 		// Let the rest of the time slot expire.
-		if(ensure_bus_transition_high(45)) { dallas_bus_error = 1; return 0; }
+		if (recovery_failed(ensure_bus_transition_high_n(timing.read_rest))) return 0;
 	}
 
 	return reply;
 }
 
-// Keeps reading bits until a 1 bit is sent
-// Sets dallas_bus_error on error
-void dallas_read_until_1(void) {
-	uint8_t curBit;
-	do {
-		curBit = dallas_read();
-	} while (!curBit && !dallas_bus_error);
+// Can set dallas_bus_error flag
+static inline void write_slot(uint8_t bit) {
+	if (dallas_speed == DALLAS_SPEED_OVERDRIVE) {
+		dallas_write_overdrive(bit);
+		return;
+	}
+	ensure_timing();
+	write_slot_standard(bit);
+}
+
+static inline uint8_t read_slot(void) {
+	if (dallas_speed == DALLAS_SPEED_OVERDRIVE) {
+		return dallas_read_overdrive();
+	}
+	ensure_timing();
+	return read_slot_standard();
 }
 
 void dallas_setup() {
 	DALLAS_PORT &= ~_BV(DALLAS_PIN);
 }
 
-// Resets the bus and returns 0x01 if a slave indicates present, 0x00 otherwise.
-// Can set dallas_bus_error flag
-uint8_t dallas_reset(void) {
+static inline uint8_t reset_slot(void) {
 	uint8_t reply;
 	// Unset bus error
 	dallas_bus_error = 0;
@@ -248,6 +420,11 @@ uint8_t dallas_reset(void) {
 	// Ensure internal pullup is disabled
 	DALLAS_PORT &= ~_BV(DALLAS_PIN);
 
+	if (dallas_speed == DALLAS_SPEED_OVERDRIVE) {
+		return dallas_reset_overdrive();
+	}
+	ensure_timing();
+
 	// Reset the slave_reply variable.
 	reply = 0x00;
 
@@ -257,30 +434,230 @@ uint8_t dallas_reset(void) {
 		set_bus_low();
 
 		// Wait the required time.
-		_delay_us(500); // 500 uS
+		timing_delay(timing.reset_low);
 
 		// Switch to an input and wait.
 		set_bus_high();
 
-		if (ensure_bus_transition_high(7)) { dallas_bus_error = 1; return 0; }
+		if (recovery_failed(ensure_bus_transition_high(RESET_RECOVERY_US))) return 0;
 
 		if ((DALLAS_PORT_IN & _BV(DALLAS_PIN)) == 0x00) {
 			reply = 0x02;
 		} else {
 
-			_delay_us(63);
+			timing_delay(timing.reset_sample);
 
 			if ((DALLAS_PORT_IN & _BV(DALLAS_PIN)) == 0x00) {
 				reply = 0x01;
 			}
 
-			if (ensure_bus_transition_high(420)) { dallas_bus_error = 1; return 0; }
+			if (recovery_failed(ensure_bus_transition_high_n(timing.reset_rest))) return 0;
 		}
 	}
 
 	return reply;
 }
 
+// Can set dallas_bus_error flag
+void dallas_write(uint8_t bit) {
+#ifdef DALLAS_TRACE
+	trace_recovery = 0;
+#endif
+	write_slot(bit);
+	trace_slot(OW_TRACE_WRITE, bit ? 1 : 0);
+}
+
+// Returns 0 or 1 on success
+// Sets dallas_bus_error flag
+uint8_t dallas_read(void) {
+	uint8_t reply;
+#ifdef DALLAS_TRACE
+	trace_recovery = 0;
+#endif
+	reply = read_slot();
+	trace_slot(OW_TRACE_READ, reply);
+	return reply;
+}
+
+// Resets the bus and returns 0x01 if a slave indicates present, 0x00 otherwise.
+// Can set dallas_bus_error flag
+uint8_t dallas_reset(void) {
+	uint8_t reply;
+#ifdef DALLAS_TRACE
+	trace_recovery = 0;
+#endif
+	reply = reset_slot();
+	trace_slot(OW_TRACE_RESET, reply);
+	return reply;
+}
+
+// Runs the slots of all of the bits in one loop, so the speed and timing are only
+// looked up once
+void dallas_write_bits(uint8_t * buffer, uint16_t num_bits) {
+	uint8_t overdrive = (dallas_speed == DALLAS_SPEED_OVERDRIVE);
+	uint8_t mask = 0x01;
+	uint8_t bit;
+
+	ensure_timing();
+	while (num_bits--) {
+		bit = *buffer & mask;
+#ifdef DALLAS_TRACE
+		trace_recovery = 0;
+#endif
+		if (overdrive) {
+			dallas_write_overdrive(bit);
+		} else {
+			write_slot_standard(bit);
+		}
+		trace_slot(OW_TRACE_WRITE, bit ? 1 : 0);
+		if (dallas_bus_error) return;
+
+		mask <<= 1;
+		if (!mask) {
+			mask = 0x01;
+			buffer++;
+		}
+	}
+}
+
+void dallas_read_bits(uint8_t * buffer, uint16_t num_bits) {
+	uint8_t overdrive = (dallas_speed == DALLAS_SPEED_OVERDRIVE);
+	uint8_t mask = 0x01;
+	uint8_t bit;
+
+	ensure_timing();
+	while (num_bits--) {
+		if (mask == 0x01) *buffer = 0;
+#ifdef DALLAS_TRACE
+		trace_recovery = 0;
+#endif
+		bit = overdrive ? dallas_read_overdrive() : read_slot_standard();
+		trace_slot(OW_TRACE_READ, bit);
+		if (dallas_bus_error) return;
+
+		if (bit) *buffer |= mask;
+		mask <<= 1;
+		if (!mask) {
+			mask = 0x01;
+			buffer++;
+		}
+	}
+}
+
+void dallas_write_byte(uint8_t byte) {
+	dallas_write_bits(&byte, 8);
+}
+
+uint8_t dallas_read_byte(void) {
+	uint8_t byte;
+	dallas_read_bits(&byte, 8);
+	if (dallas_bus_error) return 0;
+	return byte;
+}
+
+// Uses the uC to power the bus.
+void dallas_drive_bus(void) {
+	// Configure the pin as an output.
+	DALLAS_DDR |= _BV(DALLAS_PIN);
+
+	// Set the bus high.
+	DALLAS_PORT |= _BV(DALLAS_PIN);
+}
+
+// Stops powering the bus and lets it float high.
+void dallas_release_bus(void) {
+	set_bus_high();
+}
+
+#else
+
+#ifdef DALLAS_TRACE
+#error "DALLAS_TRACE is only supported by DALLAS_BACKEND_GPIO"
+#endif
+
+// The other backends have fixed timing
+uint8_t dallas_set_timing(DALLAS_TIMING_t * t) {
+	return 1;
+}
+
+uint8_t dallas_set_timing_profile(uint8_t profile) {
+	return (profile == DALLAS_TIMING_STANDARD) ? 0 : 1;
+}
+
+#endif
+
+///////////////
+// Functions //
+///////////////
+
+// Number of dallas_pullup_tick() calls left before the strong pullup is released
+volatile uint16_t dallas_pullup_ticks = 0;
+
+void dallas_write_byte_pullup(uint8_t byte, uint16_t ticks) {
+	uint8_t position;
+
+#ifdef DALLAS_BACKEND_NO_DRIVE_BUS
+	if (ticks) {
+		dallas_bus_error = DALLAS_ERR_UNSUPPORTED;
+		return;
+	}
+#endif
+	for (position = 0; position < 7; position++) {
+		dallas_write(byte & _BV(position));
+		if (dallas_bus_error) return;
+	}
+	// Turn on the pullup right after the last slot, before an interrupt can run
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		dallas_write(byte & 0x80);
+		if (!dallas_bus_error && ticks) {
+			dallas_drive_bus();
+			dallas_pullup_ticks = ticks;
+		}
+	}
+}
+
+void dallas_pullup_tick(void) {
+	if (dallas_pullup_ticks && !--dallas_pullup_ticks) {
+		dallas_release_bus();
+	}
+}
+
+uint8_t dallas_pullup_active(void) {
+	uint8_t active;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		active = dallas_pullup_ticks ? 1 : 0;
+	}
+	return active;
+}
+
+uint8_t dallas_read_power_supply(DALLAS_IDENTIFIER_t * identifier) {
+	uint8_t bit;
+
+	if (identifier) {
+		dallas_match_rom(identifier);
+	} else {
+		dallas_skip_rom();
+	}
+	if (dallas_bus_error) return 0;
+	dallas_write_byte(READ_POWER_SUPPLY_COMMAND);
+	if (dallas_bus_error) return 0;
+	// Parasite powered devices pull the bus low
+	bit = dallas_read();
+	if (dallas_bus_error) return 0;
+	return bit ? 0 : 1;
+}
+
+// Keeps reading bits until a 1 bit is sent
+// Sets dallas_bus_error on error
+void dallas_read_until_1(void) {
+	uint8_t curBit;
+	do {
+		curBit = dallas_read();
+	} while (!curBit && !dallas_bus_error);
+}
+
+#ifndef DALLAS_BACKEND_BYTE_IO
+
 void dallas_write_byte(uint8_t byte) {
 	uint8_t position;
 
@@ -306,13 +683,72 @@ uint8_t dallas_read_byte(void) {
 	return byte;
 }
 
-// Uses the uC to power the bus.
-void dallas_drive_bus(void) {
-	// Configure the pin as an output.
-	DALLAS_DDR |= _BV(DALLAS_PIN);
+#endif
 
-	// Set the bus high.
-	DALLAS_PORT |= _BV(DALLAS_PIN);
+// Pushes a byte into a running crc of the given type, with the MCRC_MODE engine
+static inline void dallas_crc_push_byte(uint8_t crc_type, uint16_t * crc, uint8_t byte) {
+	if (crc_type == DALLAS_CRC16) {
+		*crc = mcrc16_push_byte(*crc, byte);
+	} else {
+		*crc = mcrc8_push_byte((uint8_t)*crc, byte);
+	}
+}
+
+// Each byte goes through the backend's byte path (one slot loop on GPIO,
+// pipelined on USART), and is pushed into the crc in the recovery time after its
+// last slot.
+void dallas_write_byte_crc(uint8_t byte, uint8_t crc_type, uint16_t * crc) {
+	dallas_write_byte(byte);
+	if (dallas_bus_error) return;
+	dallas_crc_push_byte(crc_type, crc, byte);
+}
+
+uint8_t dallas_read_byte_crc(uint8_t crc_type, uint16_t * crc) {
+	uint8_t byte;
+
+	byte = dallas_read_byte();
+	if (dallas_bus_error) return 0;
+	dallas_crc_push_byte(crc_type, crc, byte);
+
+	return byte;
+}
+
+// Remembers identifier as the selected device
+static inline void remember_selected(DALLAS_IDENTIFIER_t * identifier) {
+	selected_identifier = *identifier;
+	selected_speed = dallas_speed;
+	selected_valid = 1;
+}
+
+void dallas_forget_selected(void) {
+	selected_valid = 0;
+}
+
+uint8_t dallas_can_resume(DALLAS_IDENTIFIER_t * identifier, uint8_t speed) {
+	uint8_t i;
+	if (!selected_valid || selected_speed != speed) return 0;
+	for (i = 0; i < DALLAS_NUM_IDENTIFIER_BITS / 8; i++) {
+		if (selected_identifier.identifier[i] != identifier->identifier[i]) return 0;
+	}
+	return 1;
+}
+
+void dallas_resume(void) {
+	if (!dallas_reset() && !dallas_bus_error) dallas_bus_error = DALLAS_ERR_NO_PRESENCE;
+	if (dallas_bus_error) {
+		// Whatever was selected is gone
+		dallas_forget_selected();
+		return;
+	}
+	dallas_write_byte(RESUME_COMMAND);
+}
+
+void dallas_match_rom_resume(DALLAS_IDENTIFIER_t * identifier) {
+	if (dallas_can_resume(identifier, dallas_speed)) {
+		dallas_resume();
+	} else {
+		dallas_match_rom(identifier);
+	}
 }
 
 void dallas_match_rom(DALLAS_IDENTIFIER_t * identifier) {
@@ -320,10 +756,10 @@ void dallas_match_rom(DALLAS_IDENTIFIER_t * identifier) {
 	uint8_t current_byte;
 	uint8_t current_bit;
 
-	if (!dallas_reset()) {
-		dallas_bus_error = 1;
-		return;
-	}
+	dallas_forget_selected();
+	// A standard speed reset brings back any devices left at overdrive
+	dallas_speed = DALLAS_SPEED_STANDARD;
+	if (!dallas_reset() && !dallas_bus_error) dallas_bus_error = DALLAS_ERR_NO_PRESENCE;
 	if (dallas_bus_error) return;
 	dallas_write_byte(MATCH_ROM_COMMAND);
 	if (dallas_bus_error) return;
@@ -335,13 +771,52 @@ void dallas_match_rom(DALLAS_IDENTIFIER_t * identifier) {
 		dallas_write(identifier->identifier[current_byte] & _BV(current_bit));
 		if (dallas_bus_error) return;
 	}
+	remember_selected(identifier);
+}
+
+void dallas_set_speed(uint8_t speed) {
+	dallas_speed = speed;
+}
+
+void dallas_overdrive_match_rom(DALLAS_IDENTIFIER_t * identifier) {
+#ifdef DALLAS_BACKEND_NO_OVERDRIVE
+	dallas_bus_error = DALLAS_ERR_UNSUPPORTED;
+	return;
+#endif
+	// A standard speed reset puts every device back to standard speed
+	dallas_speed = DALLAS_SPEED_STANDARD;
+	dallas_forget_selected();
+	if (!dallas_reset() && !dallas_bus_error) dallas_bus_error = DALLAS_ERR_NO_PRESENCE;
+	if (dallas_bus_error) return;
+	dallas_write_byte(OVERDRIVE_MATCH_ROM_COMMAND);
+	if (dallas_bus_error) return;
+
+	// The matched device switches to overdrive right after the command
+	dallas_speed = DALLAS_SPEED_OVERDRIVE;
+	dallas_write_buffer(identifier->identifier, DALLAS_NUM_IDENTIFIER_BITS / 8);
+	if (dallas_bus_error) return;
+	remember_selected(identifier);
+}
+
+void dallas_overdrive_skip_rom(void) {
+#ifdef DALLAS_BACKEND_NO_OVERDRIVE
+	dallas_bus_error = DALLAS_ERR_UNSUPPORTED;
+	return;
+#endif
+	dallas_speed = DALLAS_SPEED_STANDARD;
+	dallas_forget_selected();
+	if (!dallas_reset() && !dallas_bus_error) dallas_bus_error = DALLAS_ERR_NO_PRESENCE;
+	if (dallas_bus_error) return;
+	dallas_write_byte(OVERDRIVE_SKIP_ROM_COMMAND);
+	if (dallas_bus_error) return;
+	dallas_speed = DALLAS_SPEED_OVERDRIVE;
 }
 
 void dallas_skip_rom(void) {
-	if (!dallas_reset()) {
-		dallas_bus_error = 1;
-		return;
-	}
+	dallas_forget_selected();
+	// A standard speed reset brings back any devices left at overdrive
+	dallas_speed = DALLAS_SPEED_STANDARD;
+	if (!dallas_reset() && !dallas_bus_error) dallas_bus_error = DALLAS_ERR_NO_PRESENCE;
 	if (dallas_bus_error) return;
 	dallas_write_byte(SKIP_ROM_COMMAND);
 }
@@ -355,104 +830,278 @@ void dallas_skip_rom(void) {
 #define SYNC_IDENT_BIT(ident, bit, val) if(val) { SET_IDENT_BIT(ident, bit); } else { CLR_IDENT_BIT(ident, bit); }
 
 
-//// Keep bitmask of bits where there was divergence.  After finishing a pass, traverse this in reverse and complete the pass at the last divergence.
+void dallas_search_start(DALLAS_SEARCH_t * search, uint8_t command, DALLAS_IDENTIFIER_t * prefix, uint8_t prefix_bits) {
+	uint8_t current_byte;
 
-uint8_t dallas_search_identifiers(void) {
-	// Current device being filled in
-	uint8_t current_device = 0;
-	// Current bit of current_device being filled in
-	// This corresponds to: identifier_list.identifiers[current_device].identifier[current_bit >> 3] |= _BV(7 - (current_bit % 8))
-	int8_t current_bit;
+	for (current_byte = 0; current_byte < DALLAS_NUM_IDENTIFIER_BITS / 8; current_byte++) {
+		search->identifier.identifier[current_byte] = prefix ? prefix->identifier[current_byte] : 0;
+	}
+	search->command = command;
+	search->prefix_bits = prefix_bits;
+	search->last_diverge_bit = -1;
+	search->state = DALLAS_SEARCH_STATE_FIRST;
+}
+
+// Each pass follows the previous identifier up to the last bit where it took the 0
+// path at a divergence, takes the 1 path there, and takes the 0 path at any
+// divergence after that.  Only the previous identifier and that bit are kept.
+uint8_t dallas_search_next(DALLAS_SEARCH_t * search) {
+	uint8_t current_bit;
 	// Current set of 2 bits received
 	uint8_t received_two_bits;
-	// Flags of bits that have diverged in the current branch
-	DALLAS_IDENTIFIER_t branch_diverge_flags;
-	// Current bit that last diverged
-	int8_t current_diverge_bit = -1;
 	uint8_t current_bit_value;
-	uint8_t current_byte;
+	// Last bit in this pass where the 0 path was taken at a divergence
+	int8_t last_zero_bit = -1;
 
-	// Clear device list
-	identifier_list.num_devices = 0;
+	if (search->state == DALLAS_SEARCH_STATE_DONE) return 2;
 
-	// Zero out branch_diverge_flags
-	for (current_byte = 0; current_byte < DALLAS_NUM_IDENTIFIER_BITS / 8; current_byte++) {
-		branch_diverge_flags.identifier[current_byte] = 0;
-	}
+	dallas_forget_selected();
+	// A standard speed reset brings back any devices left at overdrive
+	dallas_speed = DALLAS_SPEED_STANDARD;
+	dallas_reset();
+	if (dallas_bus_error) return 3;
+	dallas_write_byte(search->command);
+	if (dallas_bus_error) return 3;
 
-	// Iterate multiple passes, discover one device per pass
-	while(1) {
-		current_bit = 0;
-		dallas_reset();
+	for (current_bit = 0; current_bit < DALLAS_NUM_IDENTIFIER_BITS; current_bit++) {
+		received_two_bits = (dallas_read() << 1);
 		if (dallas_bus_error) return 3;
-		dallas_write_byte(SEARCH_ROM_COMMAND);
+		received_two_bits += dallas_read();
 		if (dallas_bus_error) return 3;
-		// Iterate through all bits
-		while(current_bit < DALLAS_NUM_IDENTIFIER_BITS) {
-			received_two_bits = (dallas_read() << 1);
-			if (dallas_bus_error) return 3;
-			received_two_bits += dallas_read();
-			if (dallas_bus_error) return 3;
-			if (current_bit < current_diverge_bit) {
-				// Follow the same path.  Ignore the received bits and go in the same previous direction.
-				current_bit_value = GET_IDENT_BIT(identifier_list.identifiers[current_device - 1], current_bit);
-				SYNC_IDENT_BIT(identifier_list.identifiers[current_device], current_bit, current_bit_value);
-				dallas_write(current_bit_value);
-			} else if (current_bit == current_diverge_bit) {
-				// This was the bit we diverged on last time.  Last time, we took a 0 path.  Now we need to take a 1 path.
-				SET_IDENT_BIT(identifier_list.identifiers[current_device], current_bit);
-				dallas_write(0x01);
-				// Clear the divergeance bit in the list (won't be relevant next path)
-				CLR_IDENT_BIT(branch_diverge_flags, current_bit);
-			} else if (received_two_bits == 0x01) {
-				// All devices have 0 bits
-				CLR_IDENT_BIT(identifier_list.identifiers[current_device], current_bit);
-				dallas_write(0x00);
-			} else if (received_two_bits == 0x02) {
-				// All devices have 1 bits
-				SET_IDENT_BIT(identifier_list.identifiers[current_device], current_bit);
-				dallas_write(0x01);
-			} else if (received_two_bits == 0x00) {
-				// Some devices have 0's some have 1's
-				// Set divergence flag and follow the 0 path
-				SET_IDENT_BIT(branch_diverge_flags, current_bit);
-				CLR_IDENT_BIT(identifier_list.identifiers[current_device], current_bit);
-				dallas_write(0x00);
-			} else {
-				// No devices on this branch match?
+		if (received_two_bits == 0x03) {
+			// No devices on this branch
+			break;
+		} else if (current_bit < search->prefix_bits) {
+			// Take the prefix path, and never mark it as a divergence, so the
+			// search never leaves the prefix
+			current_bit_value = GET_IDENT_BIT(search->identifier, current_bit) ? 0x01 : 0x00;
+			if (received_two_bits == (current_bit_value ? 0x01 : 0x02)) {
+				// No devices with this prefix
 				break;
 			}
-			if (dallas_bus_error) return 3;
-			current_bit++;
-		}
-		// If we didn't complete a path, it was an error (or no device found)
-		if (current_bit != DALLAS_NUM_IDENTIFIER_BITS) {
-			return 1;
+		} else if (received_two_bits == 0x01) {
+			// All devices have 0 bits
+			current_bit_value = 0x00;
+		} else if (received_two_bits == 0x02) {
+			// All devices have 1 bits
+			current_bit_value = 0x01;
+		} else {
+			// Some devices have 0's some have 1's
+			if ((int8_t)current_bit < search->last_diverge_bit) {
+				// Follow the same path as last time
+				current_bit_value = GET_IDENT_BIT(search->identifier, current_bit) ? 0x01 : 0x00;
+			} else if ((int8_t)current_bit == search->last_diverge_bit) {
+				// Last time we took the 0 path here.  Now take the 1 path.
+				current_bit_value = 0x01;
+			} else {
+				current_bit_value = 0x00;
+			}
+			if (!current_bit_value) last_zero_bit = current_bit;
 		}
-		// Increment number of devices
-		current_device++;
-		if (current_device >= DALLAS_NUM_DEVICES) {
+		SYNC_IDENT_BIT(search->identifier, current_bit, current_bit_value);
+		dallas_write(current_bit_value);
+		if (dallas_bus_error) return 3;
+	}
+
+	// If we didn't complete a path, it was an error (or no device found)
+	if (current_bit != DALLAS_NUM_IDENTIFIER_BITS) {
+		// Nobody answering at the start of the first pass just means there are no
+		// devices (or no alarmed devices, or none with the prefix)
+		if (search->state == DALLAS_SEARCH_STATE_FIRST && (current_bit == 0 || current_bit < search->prefix_bits)) {
+			search->state = DALLAS_SEARCH_STATE_DONE;
 			return 2;
 		}
-		// Traverse branch_diverge_flags backwards until the diverge bit was found
-		for (current_diverge_bit = DALLAS_NUM_IDENTIFIER_BITS - 1; current_diverge_bit >= 0; current_diverge_bit--) {
-			if (GET_IDENT_BIT(branch_diverge_flags, current_diverge_bit)) {
-				break;
+		return 1;
+	}
+	if (mcrc8_push_buf(0, search->identifier.identifier, DALLAS_NUM_IDENTIFIER_BITS / 8)) {
+		return 1;
+	}
+
+	search->last_diverge_bit = last_zero_bit;
+	search->state = (last_zero_bit < 0) ? DALLAS_SEARCH_STATE_DONE : DALLAS_SEARCH_STATE_RUNNING;
+	return 0;
+}
+
+uint8_t dallas_search_each(uint8_t command, void (*callback)(DALLAS_IDENTIFIER_t *)) {
+	DALLAS_SEARCH_t search;
+	uint8_t result;
+
+	dallas_search_start(&search, command, 0, 0);
+	while (!(result = dallas_search_next(&search))) {
+		callback(&search.identifier);
+	}
+	return (result == 2) ? 0 : result;
+}
+
+// Shared by all of the list searches.  command is the search command to send.  The
+// first prefix_bits bits of every identifier are forced to the bits of prefix
+// (which can be null if prefix_bits is 0), so only devices starting with that
+// prefix are found.
+uint8_t dallas_search_identifiers_cmd(uint8_t command, DALLAS_IDENTIFIER_t * prefix, uint8_t prefix_bits) {
+	DALLAS_SEARCH_t search;
+	uint8_t result;
+
+	// Clear device list
+	identifier_list.num_devices = 0;
+
+	dallas_search_start(&search, command, prefix, prefix_bits);
+	while (1) {
+		result = dallas_search_next(&search);
+		if (result == 2) {
+			// A plain search should always find something
+			if (identifier_list.num_devices == 0 && command == SEARCH_ROM_COMMAND && prefix_bits == 0) {
+				return 1;
 			}
-		}
-		if (current_diverge_bit < 0) {
-			// No divergence.  All done.
-			identifier_list.num_devices = current_device;
 			return 0;
 		}
+		if (result) {
+			identifier_list.num_devices = 0;
+			return result;
+		}
+		if (identifier_list.num_devices >= DALLAS_NUM_DEVICES) {
+			// Keep the devices that fit
+			return 2;
+		}
+		identifier_list.identifiers[identifier_list.num_devices++] = search.identifier;
 	}
 }
 
 
+uint8_t dallas_search_identifiers(void) {
+	return dallas_search_identifiers_cmd(SEARCH_ROM_COMMAND, 0, 0);
+}
+
+uint8_t dallas_alarm_search_identifiers(void) {
+	return dallas_search_identifiers_cmd(ALARM_SEARCH_COMMAND, 0, 0);
+}
+
+uint8_t dallas_search_prefix(DALLAS_IDENTIFIER_t * prefix, uint8_t prefix_bits) {
+	return dallas_search_identifiers_cmd(SEARCH_ROM_COMMAND, prefix, prefix_bits);
+}
+
+uint8_t dallas_search_family(uint8_t family_code) {
+	DALLAS_IDENTIFIER_t prefix;
+	prefix.identifier[0] = family_code;
+	return dallas_search_identifiers_cmd(SEARCH_ROM_COMMAND, &prefix, 8);
+}
+
 DALLAS_IDENTIFIER_LIST_t * get_identifier_list(void) {
 	return &identifier_list;
 }
 
+// Returns 1 if some identifier in the list matches ident in bits 0 to bit - 1 and
+// has the opposite value at bit
+uint8_t identifier_list_has_sibling(DALLAS_IDENTIFIER_t * ident, uint8_t bit) {
+	uint8_t i;
+	uint8_t b;
+	uint8_t last_byte = BYTE_OF_BIT(bit);
+	uint8_t bit_mask = _BV(BIT_OF_BIT(bit));
+	uint8_t prefix_mask = (uint8_t)((bit_mask << 1) - 1);
+	DALLAS_IDENTIFIER_t * other;
+
+	for (i = 0; i < identifier_list.num_devices; i++) {
+		other = &identifier_list.identifiers[i];
+		for (b = 0; b < last_byte; b++) {
+			if (other->identifier[b] != ident->identifier[b]) break;
+		}
+		if (b < last_byte) continue;
+		if (((other->identifier[last_byte] ^ ident->identifier[last_byte]) & prefix_mask) == bit_mask) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Runs a single search pass that always takes the path of ident.  Returns...
+// 0 - if the device answered on every bit
+// 1 - if the device is not on the bus, or there was a bus error
+// 2 - if the pass ran into a branch not covered by the identifier list (a new device)
+uint8_t dallas_verify_identifier(DALLAS_IDENTIFIER_t * ident) {
+	uint8_t current_bit;
+	uint8_t received_two_bits;
+	uint8_t current_bit_value;
+
+	dallas_forget_selected();
+	// A standard speed reset brings back any devices left at overdrive
+	dallas_speed = DALLAS_SPEED_STANDARD;
+	if (!dallas_reset()) return 1;
+	if (dallas_bus_error) return 1;
+	dallas_write_byte(SEARCH_ROM_COMMAND);
+	if (dallas_bus_error) return 1;
+
+	for (current_bit = 0; current_bit < DALLAS_NUM_IDENTIFIER_BITS; current_bit++) {
+		received_two_bits = (dallas_read() << 1);
+		if (dallas_bus_error) return 1;
+		received_two_bits += dallas_read();
+		if (dallas_bus_error) return 1;
+		current_bit_value = GET_IDENT_BIT((*ident), current_bit) ? 0x01 : 0x00;
+		if (received_two_bits == 0x03) {
+			// Nobody left on this path
+			return 1;
+		} else if (received_two_bits == (current_bit_value ? 0x01 : 0x02)) {
+			// Everyone left has the other bit value
+			return 1;
+		} else if (received_two_bits == 0x00) {
+			// Something is down the other branch too.  It should be in the list.
+			if (!identifier_list_has_sibling(ident, current_bit)) return 2;
+		}
+		dallas_write(current_bit_value);
+		if (dallas_bus_error) return 1;
+	}
+	return 0;
+}
+
+uint8_t dallas_verify_identifiers(void) {
+	uint8_t i;
+	uint8_t res;
+
+	if (!identifier_list.num_devices) return 1;
+	for (i = 0; i < identifier_list.num_devices; i++) {
+		res = dallas_verify_identifier(&identifier_list.identifiers[i]);
+		if (res) return res;
+	}
+	return 0;
+}
+
+#ifdef DALLAS_ID_LIST_EEPROM_ADDR
+
+void dallas_save_identifiers(void) {
+	// Each byte written takes ~3.4 ms, so leave interrupts on.  avr-libc already
+	// disables them around the timed EEMPE/EEPE sequence.
+	eeprom_update_block(&identifier_list, DALLAS_ID_LIST_EEPROM_ADDR, sizeof(identifier_list));
+}
+
+uint8_t dallas_load_identifiers(void) {
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		eeprom_read_block(&identifier_list, DALLAS_ID_LIST_EEPROM_ADDR, sizeof(identifier_list));
+	}
+	// Erased EEPROM reads as 0xFF, so this also catches a list never saved
+	if (identifier_list.num_devices > DALLAS_NUM_DEVICES) {
+		identifier_list.num_devices = 0;
+		return 1;
+	}
+	for (i = 0; i < identifier_list.num_devices; i++) {
+		if (mcrc8_push_buf(0, identifier_list.identifiers[i].identifier, DALLAS_NUM_IDENTIFIER_BITS / 8)) {
+			identifier_list.num_devices = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+uint8_t dallas_restore_identifiers(void) {
+	uint8_t res;
+
+	if (!dallas_load_identifiers() && !dallas_verify_identifiers()) return 0;
+	res = dallas_search_identifiers();
+	if (!res) dallas_save_identifiers();
+	return res;
+}
+
+#endif
+
 
 void dallas_write_buffer(uint8_t * buffer, uint8_t buffer_length) {
 	uint8_t i;
@@ -472,18 +1121,160 @@ void dallas_read_buffer(uint8_t * buffer, uint8_t buffer_length) {
 	}
 }
 
+#ifndef DALLAS_BACKEND_BIT_IO
+
+void dallas_write_bits(uint8_t * buffer, uint16_t num_bits) {
+	uint8_t bit = 0x01;
+
+	// Whole bytes go through dallas_write_byte(), which some backends pipeline
+	for (; num_bits >= 8; num_bits -= 8) {
+		dallas_write_byte(*buffer++);
+		if (dallas_bus_error) return;
+	}
+	while (num_bits--) {
+		dallas_write(*buffer & bit);
+		if (dallas_bus_error) return;
+		bit <<= 1;
+	}
+}
+
+void dallas_read_bits(uint8_t * buffer, uint16_t num_bits) {
+	uint8_t bit = 0x01;
+
+	for (; num_bits >= 8; num_bits -= 8) {
+		*buffer++ = dallas_read_byte();
+		if (dallas_bus_error) return;
+	}
+	if (!num_bits) return;
+	*buffer = 0;
+	while (num_bits--) {
+		if (dallas_read()) *buffer |= bit;
+		if (dallas_bus_error) return;
+		bit <<= 1;
+	}
+}
+
+#endif
+
+void dallas_write_buffer_crc(uint8_t * buffer, uint8_t buffer_length, uint8_t crc_type, uint16_t * crc) {
+	uint8_t i;
+
+	for (i = 0x00; i < buffer_length; i++) {
+		dallas_write_byte_crc(buffer[i], crc_type, crc);
+		if (dallas_bus_error) return;
+	}
+}
+
+void dallas_read_buffer_crc(uint8_t * buffer, uint8_t buffer_length, uint8_t crc_type, uint16_t * crc) {
+	uint8_t i;
+
+	for (i = 0x00; i < buffer_length; i++) {
+		buffer[i] = dallas_read_byte_crc(crc_type, crc);
+		if (dallas_bus_error) return;
+	}
+}
+
+/////////////////////////////
+// Multi-master arbitration //
+/////////////////////////////
+
+// How long the bus must be idle before starting a transaction
+#define TXN_IDLE_US 500
+// Length of each backoff slot added on top of that
+#define TXN_BACKOFF_SLOT_US 20
+// The bus is polled this often while waiting
+#define TXN_POLL_US 5
+
+#define bus_is_low() (!(DALLAS_PORT_IN & _BV(DALLAS_PIN)))
+
+DALLAS_TXN_STATS_t dallas_txn_stats;
+
+// State of the backoff random number generator (never 0)
+uint8_t txn_random = 1;
+
+void dallas_txn_seed(uint8_t seed) {
+	txn_random = seed ? seed : 1;
+}
+
+// 8-bit Galois LFSR (period 255)
+static inline uint8_t txn_next_random() {
+	uint8_t lsb = txn_random & 0x01;
+	txn_random >>= 1;
+	if (lsb) txn_random ^= 0xB8;
+	return txn_random;
+}
+
+// Waits until the bus has been idle for TXN_IDLE_US plus a random number of
+// backoff slots.  If another master takes the bus first, waits for it to finish
+// and tries again with a smaller backoff window, so the masters that have waited
+// longest tend to win over ones that just started waiting.
+// Returns 0 when the bus is free, or 1 after DALLAS_TXN_TIMEOUT_MS .
+uint8_t dallas_arbitrate() {
+	// Time waited, in TXN_POLL_US units (loop overhead isn't counted)
+	uint32_t waited = 0;
+	uint16_t idle_polls;
+	uint16_t i;
+	uint8_t window = DALLAS_TXN_BACKOFF_SLOTS;
+
+	for (;;) {
+		idle_polls = TXN_IDLE_US / TXN_POLL_US + (txn_next_random() % window) * (TXN_BACKOFF_SLOT_US / TXN_POLL_US);
+		for (i = 0; i < idle_polls; i++) {
+			if (bus_is_low()) break;
+			_delay_us(TXN_POLL_US);
+		}
+		waited += i;
+		if (i == idle_polls) break;
+
+		// Someone else has the bus
+		dallas_txn_stats.collisions++;
+		if (window > 1) window >>= 1;
+		while (bus_is_low()) {
+			_delay_us(TXN_POLL_US);
+			waited++;
+#if DALLAS_TXN_TIMEOUT_MS
+			if (waited >= DALLAS_TXN_TIMEOUT_MS * (1000UL / TXN_POLL_US)) break;
+#endif
+		}
+#if DALLAS_TXN_TIMEOUT_MS
+		if (waited >= DALLAS_TXN_TIMEOUT_MS * (1000UL / TXN_POLL_US)) {
+			dallas_txn_stats.timeouts++;
+			return 1;
+		}
+#endif
+	}
+
+	waited *= TXN_POLL_US;
+	dallas_txn_stats.acquisitions++;
+	dallas_txn_stats.total_wait_us += waited;
+	if (waited > dallas_txn_stats.max_wait_us) dallas_txn_stats.max_wait_us = waited;
+	return 0;
+}
+
+DALLAS_TXN_STATS_t * get_txn_stats(void) {
+	return &dallas_txn_stats;
+}
+
+void dallas_clear_txn_stats(void) {
+	dallas_txn_stats.acquisitions = 0;
+	dallas_txn_stats.collisions = 0;
+	dallas_txn_stats.timeouts = 0;
+	dallas_txn_stats.total_wait_us = 0;
+	dallas_txn_stats.max_wait_us = 0;
+}
+
+#if DALLAS_BACKEND == DALLAS_BACKEND_GPIO
+
 void dallas_hold_txn() {
 	dallas_bus_error = 0;
 	set_bus_low();
 }
 
 void dallas_begin_txn() {
-	uint8_t ret;
 	dallas_bus_error = 0;
 	set_bus_high();
-	for (;;) {
-		if (!ensure_bus_high(500)) break;
-		_delay_us(123);
+	if (dallas_arbitrate()) {
+		dallas_bus_error = DALLAS_ERR_TXN_TIMEOUT;
+		return;
 	}
 	dallas_hold_txn();
 }
@@ -492,3 +1283,5 @@ void dallas_end_txn() {
 	dallas_bus_error = 0;
 	set_bus_high();
 }
+
+#endif
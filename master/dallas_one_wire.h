@@ -42,6 +42,64 @@
 
 #include "./one_wire_conf.h"
 
+#ifdef DALLAS_TRACE
+#include "one_wire_trace.h"
+#endif
+
+// Slot backends.  DALLAS_BACKEND selects which one implements the bus-level
+// functions (setup, reset, read/write slots, drive bus, and transactions).
+// Everything else is shared.
+// Bit-banged GPIO with busy-wait delays (dallas_one_wire.c)
+#define DALLAS_BACKEND_GPIO 1
+// Timer 1 output compare generates the low pulses (dallas_one_wire_oc.c)
+#define DALLAS_BACKEND_OC 2
+// USART0 sends one byte per slot (dallas_one_wire_usart.c)
+#define DALLAS_BACKEND_USART 3
+
+#ifndef DALLAS_BACKEND
+#define DALLAS_BACKEND DALLAS_BACKEND_GPIO
+#endif
+
+// Backends that can run the 8 slots of a byte back to back also implement
+// dallas_write_byte() and dallas_read_byte()
+#if DALLAS_BACKEND == DALLAS_BACKEND_USART || DALLAS_BACKEND == DALLAS_BACKEND_GPIO
+#define DALLAS_BACKEND_BYTE_IO
+#endif
+
+// Backends that run any number of slots in one loop also implement
+// dallas_write_bits() and dallas_read_bits()
+#if DALLAS_BACKEND == DALLAS_BACKEND_GPIO
+#define DALLAS_BACKEND_BIT_IO
+#endif
+
+// Backends that can't run overdrive slots.  Overdrive ROM commands (and requests
+// with DALLAS_REQ_OVERDRIVE) fail with DALLAS_ERR_UNSUPPORTED instead.  The USART
+// backend only has baud rates for standard speed slots and resets.  Defining
+// DALLAS_NO_OVERDRIVE in one_wire_conf.h compiles overdrive out of the other
+// backends the same way.  The GPIO backend needs it below about 6 MHz, where its
+// overdrive slots can't meet their timing (the build fails otherwise).
+#if DALLAS_BACKEND == DALLAS_BACKEND_USART || defined(DALLAS_NO_OVERDRIVE)
+#define DALLAS_BACKEND_NO_OVERDRIVE
+#endif
+
+// Backends that can only pull the bus low, and so can't power it.
+// dallas_drive_bus() and dallas_write_byte_pullup() fail with
+// DALLAS_ERR_UNSUPPORTED instead.
+#if DALLAS_BACKEND == DALLAS_BACKEND_OC || DALLAS_BACKEND == DALLAS_BACKEND_USART
+#define DALLAS_BACKEND_NO_DRIVE_BUS
+#endif
+
+// Longest time dallas_begin_txn() waits for the bus, in milliseconds.  0 waits
+// forever.
+#ifndef DALLAS_TXN_TIMEOUT_MS
+#define DALLAS_TXN_TIMEOUT_MS 100
+#endif
+
+// Initial number of backoff slots for multi-master arbitration (a power of 2)
+#ifndef DALLAS_TXN_BACKOFF_SLOTS
+#define DALLAS_TXN_BACKOFF_SLOTS 16
+#endif
+
 // The number of devices on the bus.
 #define DALLAS_NUM_DEVICES 16
 
@@ -53,9 +111,44 @@
 #define MATCH_ROM_COMMAND 	0x55
 #define SKIP_ROM_COMMAND	0xCC
 #define SEARCH_ROM_COMMAND 	0xF0
+#define ALARM_SEARCH_COMMAND	0xEC
 #define READ_ROM_COMMAND	0x33
+#define OVERDRIVE_SKIP_ROM_COMMAND	0x3C
+#define OVERDRIVE_MATCH_ROM_COMMAND	0x69
+#define RESUME_COMMAND	0xA5
+
+// Function commands
+#define READ_POWER_SUPPLY_COMMAND	0xB4
+
+// Bus speeds
+#define DALLAS_SPEED_STANDARD 0
+#define DALLAS_SPEED_OVERDRIVE 1
+
+// CRC types for the *_crc functions
+#define DALLAS_CRC8 1
+#define DALLAS_CRC16 2
+
+// Values of dallas_bus_error .  Anything nonzero is an error, so existing
+// checks of the form "if (dallas_bus_error)" still work.
+#define DALLAS_ERR_NONE 0
+// The bus was low at the start of a slot (another master, or a slave that
+// lost sync)
+#define DALLAS_ERR_BUS_LOW 1
+// No device answered the reset with a presence pulse
+#define DALLAS_ERR_NO_PRESENCE 2
+// The bus didn't come back up after being released (shorted or overloaded)
+#define DALLAS_ERR_SHORT 3
+// The bus came back up, then was pulled low again when it should have stayed
+// high (during recovery, or inside a write 1 slot)
+#define DALLAS_ERR_EARLY_LOW 4
+// The bus wasn't free for a transaction within DALLAS_TXN_TIMEOUT_MS
+#define DALLAS_ERR_TXN_TIMEOUT 5
+// The backend can't do what was asked (ie, overdrive on the USART backend, or a
+// strong pullup on the OC and USART backends)
+#define DALLAS_ERR_UNSUPPORTED 6
 
 extern uint8_t dallas_bus_error;
+extern uint8_t dallas_speed;
 
 ////////////////
 // Structures //
@@ -70,6 +163,66 @@ typedef struct {
 	uint8_t num_devices;
 } DALLAS_IDENTIFIER_LIST_t;
 
+// Multi-master arbitration counters.  Wait times are approximate.
+typedef struct {
+	// Number of transactions started
+	uint16_t acquisitions;
+	// Number of times another master took the bus while we were waiting
+	uint16_t collisions;
+	// Number of times dallas_begin_txn() gave up
+	uint16_t timeouts;
+	// Total and longest time spent waiting in dallas_begin_txn()
+	uint32_t total_wait_us;
+	uint32_t max_wait_us;
+} DALLAS_TXN_STATS_t;
+
+// Standard speed slot timing, in microseconds.  Only used by the GPIO backend.
+typedef struct {
+	// Reset pulse, time from its end to sampling the presence pulse, and the rest
+	// of the reset
+	uint16_t reset_low;
+	uint16_t reset_sample;
+	uint16_t reset_rest;
+	// Write 0 pulse and the rest of its slot
+	uint16_t write_0_low;
+	uint16_t write_0_rest;
+	// Write 1 pulse and the rest of its slot
+	uint16_t write_1_low;
+	uint16_t write_1_rest;
+	// Read pulse, time from its end to sampling, and the rest of the slot
+	uint16_t read_low;
+	uint16_t read_sample;
+	uint16_t read_rest;
+} DALLAS_TIMING_t;
+
+// Built in timing profiles for dallas_set_timing_profile()
+// The default, with some margin everywhere
+#define DALLAS_TIMING_STANDARD 0
+// Close to the minimums in the spec, for short buses
+#define DALLAS_TIMING_FAST 1
+// Longer recovery, for long lines with slow rising edges
+#define DALLAS_TIMING_LONG_LINE 2
+
+#define DALLAS_TIMING_STANDARD_INIT { 500, 70, 420, 60, 30, 10, 50, 2, 13, 45 }
+#define DALLAS_TIMING_FAST_INIT { 480, 70, 410, 60, 5, 5, 60, 2, 10, 53 }
+#define DALLAS_TIMING_LONG_LINE_INIT { 560, 70, 480, 70, 30, 8, 92, 3, 10, 87 }
+
+// Values of DALLAS_SEARCH_t.state
+#define DALLAS_SEARCH_STATE_FIRST 0
+#define DALLAS_SEARCH_STATE_RUNNING 1
+#define DALLAS_SEARCH_STATE_DONE 2
+
+// State of a streaming search.  Only needs the last identifier found and the bit
+// where the next pass branches off, so any number of devices can be enumerated.
+typedef struct {
+	// Last identifier found.  Holds the prefix before the first pass.
+	DALLAS_IDENTIFIER_t identifier;
+	uint8_t command;
+	uint8_t prefix_bits;
+	int8_t last_diverge_bit;
+	uint8_t state;
+} DALLAS_SEARCH_t;
+
 ///////////////
 // Functions //
 ///////////////
@@ -85,6 +238,11 @@ void dallas_write_byte(uint8_t);
 // Write the specified number of bytes to the bus from the supplied buffer.
 void dallas_write_buffer(uint8_t * buffer, uint8_t buffer_length);
 
+// Same as above, but also pushes each byte into the running crc (of type
+// crc_type) as soon as it is written, with the MCRC_MODE engine.
+void dallas_write_byte_crc(uint8_t byte, uint8_t crc_type, uint16_t * crc);
+void dallas_write_buffer_crc(uint8_t * buffer, uint8_t buffer_length, uint8_t crc_type, uint16_t * crc);
+
 // Read a bit from the bus and returns it as the LSB.
 uint8_t dallas_read(void);
 
@@ -97,35 +255,193 @@ uint8_t dallas_read_byte(void);
 // Reads the specified number of bytes from the bus into the supplied buffer.
 void dallas_read_buffer(uint8_t * buffer, uint8_t buffer_length);
 
+// Write or read the specified number of bits, packed LSB of the first byte
+// first.  Unused bits of the last byte read are cleared.
+void dallas_write_bits(uint8_t * buffer, uint16_t num_bits);
+void dallas_read_bits(uint8_t * buffer, uint16_t num_bits);
+
+// Same as above, but also pushes each byte into the running crc (of type
+// crc_type) as soon as it is read, with the MCRC_MODE engine, so the crc is
+// complete right after the last byte.
+uint8_t dallas_read_byte_crc(uint8_t crc_type, uint16_t * crc);
+void dallas_read_buffer_crc(uint8_t * buffer, uint8_t buffer_length, uint8_t crc_type, uint16_t * crc);
+
 // Resets the bus. Returns...
 // 1 - if a device or devices indicate presence
 // 0 - otherwise
 uint8_t dallas_reset(void);
 
-// Powers the bus from the AVR (max 40 mA).
+// Powers the bus from the AVR (max 40 mA).  Sets dallas_bus_error to
+// DALLAS_ERR_UNSUPPORTED on backends that can't (DALLAS_BACKEND_NO_DRIVE_BUS).
 void dallas_drive_bus(void);
 
+// Stops powering the bus.
+void dallas_release_bus(void);
+
+// Writes a byte and powers the bus (as dallas_drive_bus()) right after its last
+// slot, for parasite powered devices that need a strong pullup during a
+// conversion or copy.  The pullup is released after ticks calls to
+// dallas_pullup_tick() .  Nothing else may use the bus until then.  With ticks 0
+// the byte is written without a pullup.  Backends that can't power the bus fail
+// with DALLAS_ERR_UNSUPPORTED without writing the byte, so a parasite powered
+// conversion is never started without power.
+void dallas_write_byte_pullup(uint8_t byte, uint16_t ticks);
+
+// Counts down the strong pullup started by dallas_write_byte_pullup() and
+// releases the bus when it expires.  Call it periodically, ie from a 1 ms timer
+// interrupt.
+void dallas_pullup_tick(void);
+
+// Returns 1 while the strong pullup is on.
+uint8_t dallas_pullup_active(void);
+
+// Sends READ POWER SUPPLY to the specified device, or to every device if the
+// identifier is null.  Returns 1 if a device is parasite powered, and 0 if not
+// or if there was a bus error.
+uint8_t dallas_read_power_supply(DALLAS_IDENTIFIER_t *);
+
 // Sends a MATCH ROM command to the specified device. Automatically resets the
-// bus.
+// bus.  Always runs at standard speed (see dallas_set_speed()).
 void dallas_match_rom(DALLAS_IDENTIFIER_t *);
 
-// Sends a SKIP ROM command. Automatically resets the bus.
+// Sends a SKIP ROM command. Automatically resets the bus.  Always runs at
+// standard speed.
 void dallas_skip_rom(void);
 
+// Sends a RESUME command, which selects the device selected by the last MATCH ROM
+// (or OVERDRIVE MATCH ROM) again without sending its identifier.  Automatically
+// resets the bus.  Only some devices (ie, the DS2431 and DS28EA00) support it.
+void dallas_resume(void);
+
+// Returns 1 if identifier was the last device selected by dallas_match_rom() or
+// dallas_overdrive_match_rom() at the given speed, and no other ROM command has
+// been sent by this library since.
+uint8_t dallas_can_resume(DALLAS_IDENTIFIER_t *, uint8_t speed);
+
+// Same as dallas_match_rom(), but uses RESUME if dallas_can_resume() at the
+// current speed.  Only for devices that support RESUME.
+void dallas_match_rom_resume(DALLAS_IDENTIFIER_t *);
+
+// Forgets which device was last selected, so the next select uses MATCH ROM.
+// Call this after sending a ROM command directly (after dallas_reset()), or when
+// another master may have used the bus.
+void dallas_forget_selected(void);
+
+// Sets the standard speed slot timing.  Returns nonzero (and keeps the current
+// timing) if it can't be met at this F_CPU.
+uint8_t dallas_set_timing(DALLAS_TIMING_t * timing);
+
+// Sets one of the built in DALLAS_TIMING_* profiles.
+uint8_t dallas_set_timing_profile(uint8_t profile);
+
+// Sets the speed used for all following slots and resets.  A standard speed
+// reset returns every device on the bus to standard speed.  Overdrive is only
+// supported by the GPIO and output compare backends.  dallas_match_rom(),
+// dallas_skip_rom(), and the searches set standard speed themselves, so only the
+// overdrive ROM commands and dallas_resume() run at overdrive.
+void dallas_set_speed(uint8_t speed);
+
+// Sends an OVERDRIVE MATCH ROM command to the specified device at standard speed,
+// then switches to overdrive and sends the identifier.  Automatically resets the
+// bus.  The bus stays at overdrive afterwards.
+void dallas_overdrive_match_rom(DALLAS_IDENTIFIER_t *);
+
+// Sends an OVERDRIVE SKIP ROM command at standard speed and switches to
+// overdrive.  Automatically resets the bus.
+void dallas_overdrive_skip_rom(void);
+
 // Populates the identifier list. Returns...
 // 0 - if devices were found and there was no error
-// 1 - if there was a bus error
-// 2 - if there were more devices than specified by DALLAS_NUM_DEVICES
+// 1 - if no device was found, or a search pass didn't complete or failed its crc
+// 2 - if there were more devices than specified by DALLAS_NUM_DEVICES (the list
+//     holds the first DALLAS_NUM_DEVICES found)
+// 3 - if there was a bus error (see dallas_bus_error)
+// The list is emptied on 1 and 3.
 uint8_t dallas_search_identifiers(void);
 
+// Same as dallas_search_identifiers(), but uses the conditional (alarm) search,
+// so only devices with their alarm flag set are listed.  Returns 0 with an empty
+// list if no device is alarmed.
+uint8_t dallas_alarm_search_identifiers(void);
+
+// Same as dallas_search_identifiers(), but only lists devices whose first
+// prefix_bits bits (LSB of byte 0 first) match prefix.  Branches outside the
+// prefix are never walked.  Returns 0 with an empty list if no device matches.
+uint8_t dallas_search_prefix(DALLAS_IDENTIFIER_t * prefix, uint8_t prefix_bits);
+
+// Same as dallas_search_prefix() with the family code (byte 0) as the prefix.
+uint8_t dallas_search_family(uint8_t family_code);
+
+// Streaming search.  Finds one device per call to dallas_search_next() without
+// using the identifier list.  command is SEARCH_ROM_COMMAND or
+// ALARM_SEARCH_COMMAND, and prefix works as in dallas_search_prefix() (it can be
+// null if prefix_bits is 0).
+void dallas_search_start(DALLAS_SEARCH_t * search, uint8_t command, DALLAS_IDENTIFIER_t * prefix, uint8_t prefix_bits);
+
+// Runs one search pass.  Returns...
+// 0 - if a device was found (in search->identifier)
+// 1 - if the pass didn't complete or the identifier failed its crc
+// 2 - if there are no more devices
+// 3 - if there was a bus error
+uint8_t dallas_search_next(DALLAS_SEARCH_t * search);
+
+// Runs a streaming search and calls callback with each identifier found.  The
+// identifier is only valid during the call.  Returns 0 when every device has
+// been found, or the error from dallas_search_next().
+uint8_t dallas_search_each(uint8_t command, void (*callback)(DALLAS_IDENTIFIER_t *));
+
 // Returns the list of identifiers.
 DALLAS_IDENTIFIER_LIST_t * get_identifier_list(void);
 
+#ifdef DALLAS_TRACE
+// Returns the trace of the master's slots (GPIO backend only).  See
+// one_wire_trace.h .
+OW_TRACE_t * get_dallas_trace(void);
+#endif
+
+// Checks the current identifier list against the bus with one directed search
+// pass per device, instead of a full search.  Returns...
+// 0 - if every listed device is present and there are no unlisted devices
+// 1 - if a listed device is missing, the list is empty, or there was a bus error
+// 2 - if there is a device on the bus that isn't listed
+uint8_t dallas_verify_identifiers(void);
+
+#ifdef DALLAS_ID_LIST_EEPROM_ADDR
+// Saves the identifier list to EEPROM at DALLAS_ID_LIST_EEPROM_ADDR .
+void dallas_save_identifiers(void);
+
+// Loads the identifier list from EEPROM.  Returns nonzero (with an empty list)
+// if nothing valid was saved.
+uint8_t dallas_load_identifiers(void);
+
+// Loads the saved identifier list and verifies it.  If that fails, does a full
+// search and saves the result.  Returns 0 on success, or the result of
+// dallas_search_identifiers() .
+uint8_t dallas_restore_identifiers(void);
+#endif
+
 // Makes sure the bus has been free for a set period of time
 // Pulls the bus low after this
 // Note that bus errors can still occur in case of arbitration, and txn should then be ended and retried
+// Sets dallas_bus_error (and leaves the bus free) if the bus wasn't free within
+// DALLAS_TXN_TIMEOUT_MS
 void dallas_begin_txn();
 
+// Waits for the bus to be free, with a random backoff, for dallas_begin_txn() .
+// Returns 0 when it is free, or 1 on timeout.
+uint8_t dallas_arbitrate();
+
+// Seeds the random backoff.  Required on a bus with more than one master: each
+// master must use a different seed (ie the crc byte of its own identifier), or
+// they all start from the same seed and back off in lockstep.
+void dallas_txn_seed(uint8_t seed);
+
+// Returns the arbitration counters.
+DALLAS_TXN_STATS_t * get_txn_stats(void);
+
+// Zeroes the arbitration counters.
+void dallas_clear_txn_stats(void);
+
 // Pulls the bus low to prepare for another reset in the same transaction
 void dallas_hold_txn();
 
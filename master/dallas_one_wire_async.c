@@ -0,0 +1,362 @@
+/*
+ * Interrupt-driven (non-blocking) 1-Wire master.  See dallas_one_wire_async.h .
+ *
+ * Each timeslot is broken up into phases.  Each phase runs from the timer compare
+ * match interrupt and schedules the next phase by advancing OCR1A, so the slot
+ * timing is relative to the previous compare match and interrupt latency does
+ * not accumulate.  The only busy-wait is the couple microseconds of the low pulse
+ * that starts a read slot, which is too short to schedule.  If an interrupt runs
+ * so late that the next phase's compare value has already passed, the phase is
+ * run as soon as possible instead of after the timer wraps (which would stretch
+ * the slot by ~65 ms at 8 MHz).
+ *
+ * The slot timing is fixed at compile time (the polled master's
+ * DALLAS_TIMING_STANDARD profile); dallas_set_timing() doesn't affect it.
+ *
+ * The bus must not be touched by the polled master (dallas_one_wire.c) while jobs
+ * are running.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+
+#include "dallas_one_wire_async.h"
+
+#include <util/atomic.h>
+#include <util/delay.h>
+
+#include "delay_helpers.h"
+
+#ifndef DALLAS_ASYNC_TIMER_VECT
+#error "DALLAS_ASYNC_TIMER_VECT must be defined in one_wire_conf.h"
+#endif
+
+// Converts microseconds to timer ticks (timer runs at clk/8)
+#define US_TO_TICKS(us) ((uint16_t)(((uint32_t)(us) * (F_CPU / 8UL)) / 1000000UL))
+
+// Slot timing in microseconds.  These match the polled master's
+// DALLAS_TIMING_STANDARD profile.
+#define RESET_LOW_US 500
+#define RESET_SAMPLE_US 70
+#define RESET_REST_US 420
+#define WRITE_0_LOW_US 60
+#define WRITE_0_REST_US 30
+#define WRITE_1_LOW_US 10
+#define WRITE_1_REST_US 50
+#define READ_LOW_US 2
+#define READ_SAMPLE_US 13
+#define READ_REST_US 45
+// Delay between dallas_async_start() and the first slot
+#define START_DELAY_US 10
+
+// Fewest ticks a compare match is scheduled ahead of TCNT1, so it can't be
+// passed before OCR1A is written
+#define MIN_SCHEDULE_TICKS 2
+
+// Estimated worst case cycles from a compare match to the bus being driven at
+// the start of the next slot: interrupt response, the ISR prologue, and the end
+// of slot checks
+#define SLOT_START_CYCLES 64
+
+// The timer must resolve the shortest phase (the write 1 pulse) to a few ticks,
+// or it is rounded down to nothing (clk/8 needs at least about 4 MHz)
+DELAY_STATIC_ASSERT(US_TO_TICKS(WRITE_1_LOW_US) >= 2 * MIN_SCHEDULE_TICKS, timer_resolves_write_1_pulse);
+// The read pulse is busy-waited inside the interrupt, and the sample is scheduled
+// from the previous compare match, so the interrupt must be done with the pulse
+// before the sample is due
+DELAY_ASSERT_BUDGET(READ_SAMPLE_US, SLOT_START_CYCLES, read_sample_fits);
+
+// Timer register values
+// Normal mode, no output pins
+#define TIMER_TCCR1A 0b00000000
+// Normal mode, clk/8
+#define TIMER_TCCR1B 0b00000010
+// Output compare A interrupt enable / flag bit
+#define TIMER_OCIE1A 0b00000010
+#define TIMER_OCF1A 0b00000010
+
+// Phases of a slot (the phase run by the next interrupt)
+#define STATE_IDLE 0
+#define STATE_SLOT_START 1
+#define STATE_RESET_RELEASE 2
+#define STATE_RESET_SAMPLE 3
+#define STATE_WRITE_RELEASE 4
+#define STATE_READ_SAMPLE 5
+#define STATE_SLOT_END 6
+
+#define pin_is_low() (!(DALLAS_PORT_IN & _BV(DALLAS_PIN)))
+#define pin_is_high() (DALLAS_PORT_IN & _BV(DALLAS_PIN))
+
+static inline void async_bus_high() {
+	// Set pin as input
+	DALLAS_DDR &= ~_BV(DALLAS_PIN);
+	// Make sure internal pullup is disabled
+	DALLAS_PORT &= ~_BV(DALLAS_PIN);
+}
+
+static inline void async_bus_low() {
+	// Configure pin as output (should already be low if initialized)
+	DALLAS_DDR |= _BV(DALLAS_PIN);
+	DALLAS_PORT &= ~_BV(DALLAS_PIN);
+}
+
+//////////////////////
+// Global variables //
+//////////////////////
+
+volatile uint8_t dallas_async_status = DALLAS_ASYNC_IDLE;
+
+// Ring buffer of jobs.  head is the running job, tail is the next free entry.
+DALLAS_ASYNC_JOB_t async_queue[DALLAS_ASYNC_QUEUE_LEN];
+volatile uint8_t async_queue_head = 0;
+volatile uint8_t async_queue_tail = 0;
+
+// Progress through the running job
+uint8_t async_state = STATE_IDLE;
+uint8_t async_byte_idx;
+uint8_t async_bit_mask;
+uint8_t async_bit_val;
+
+void (*async_callback)(uint8_t status) = 0;
+
+// Used by dallas_async_queue_match_rom() and dallas_async_queue_skip_rom()
+uint8_t async_match_rom_command = MATCH_ROM_COMMAND;
+uint8_t async_skip_rom_command = SKIP_ROM_COMMAND;
+
+#define QUEUE_NEXT(idx) (((idx) + 1) % DALLAS_ASYNC_QUEUE_LEN)
+#define QUEUE_COUNT() ((uint8_t)(async_queue_tail - async_queue_head + DALLAS_ASYNC_QUEUE_LEN) % DALLAS_ASYNC_QUEUE_LEN)
+
+///////////////
+// Functions //
+///////////////
+
+// Schedules the next phase relative to the current compare match.  If that time
+// has already passed (the interrupt ran late), schedules it as soon as possible.
+static inline void async_schedule(uint16_t ticks) {
+	uint16_t next = OCR1A + ticks;
+	uint16_t now = TCNT1;
+	if ((int16_t)(next - now) < MIN_SCHEDULE_TICKS) {
+		next = now + MIN_SCHEDULE_TICKS;
+	}
+	OCR1A = next;
+}
+
+// Stops processing, flushes the queue, and reports the status
+static inline void async_finish(uint8_t status) {
+	TIMSK1 &= ~TIMER_OCIE1A;
+	async_bus_high();
+	async_queue_head = async_queue_tail;
+	async_state = STATE_IDLE;
+	dallas_async_status = status;
+	if (async_callback) async_callback(status);
+}
+
+static inline void async_next_job() {
+	async_queue_head = QUEUE_NEXT(async_queue_head);
+	async_byte_idx = 0;
+	async_bit_mask = 0x01;
+}
+
+// Moves on to the next bit, byte, or job after a slot finishes
+static inline void async_advance(DALLAS_ASYNC_JOB_t * job) {
+	if (job->type == DALLAS_ASYNC_JOB_RESET) {
+		async_next_job();
+		return;
+	}
+	async_bit_mask <<= 1;
+	if (!async_bit_mask) {
+		async_bit_mask = 0x01;
+		async_byte_idx++;
+		if (async_byte_idx >= job->len) {
+			async_next_job();
+		}
+	}
+}
+
+// Starts the next slot, or finishes if there are no more jobs
+static inline void async_start_slot() {
+	DALLAS_ASYNC_JOB_t * job;
+
+	// Skip over empty jobs
+	for (;;) {
+		if (async_queue_head == async_queue_tail) {
+			async_finish(DALLAS_ASYNC_DONE);
+			return;
+		}
+		job = &async_queue[async_queue_head];
+		if (job->type == DALLAS_ASYNC_JOB_RESET || async_byte_idx < job->len) break;
+		async_next_job();
+	}
+
+	// Make sure the bus is high
+	if (pin_is_low()) {
+		async_finish(DALLAS_ASYNC_BUS_ERROR);
+		return;
+	}
+
+	switch (job->type) {
+		case DALLAS_ASYNC_JOB_RESET:
+			async_bus_low();
+			async_schedule(US_TO_TICKS(RESET_LOW_US));
+			async_state = STATE_RESET_RELEASE;
+			break;
+		case DALLAS_ASYNC_JOB_WRITE:
+			async_bit_val = job->buf[async_byte_idx] & async_bit_mask;
+			async_bus_low();
+			if (async_bit_val) {
+				async_schedule(US_TO_TICKS(WRITE_1_LOW_US));
+			} else {
+				async_schedule(US_TO_TICKS(WRITE_0_LOW_US));
+			}
+			async_state = STATE_WRITE_RELEASE;
+			break;
+		case DALLAS_ASYNC_JOB_READ:
+			if (async_bit_mask == 0x01) job->buf[async_byte_idx] = 0;
+			async_bus_low();
+			_delay_us(READ_LOW_US);
+			async_bus_high();
+			async_schedule(US_TO_TICKS(READ_LOW_US + READ_SAMPLE_US));
+			async_state = STATE_READ_SAMPLE;
+			break;
+	}
+}
+
+ISR(DALLAS_ASYNC_TIMER_VECT) {
+	DALLAS_ASYNC_JOB_t * job = &async_queue[async_queue_head];
+
+	switch (async_state) {
+		case STATE_RESET_RELEASE:
+			async_bus_high();
+			async_schedule(US_TO_TICKS(RESET_SAMPLE_US));
+			async_state = STATE_RESET_SAMPLE;
+			return;
+		case STATE_RESET_SAMPLE:
+			if (pin_is_high()) {
+				async_finish(DALLAS_ASYNC_NO_PRESENCE);
+				return;
+			}
+			async_schedule(US_TO_TICKS(RESET_REST_US));
+			async_state = STATE_SLOT_END;
+			return;
+		case STATE_WRITE_RELEASE:
+			async_bus_high();
+			if (async_bit_val) {
+				async_schedule(US_TO_TICKS(WRITE_1_REST_US));
+			} else {
+				async_schedule(US_TO_TICKS(WRITE_0_REST_US));
+			}
+			async_state = STATE_SLOT_END;
+			return;
+		case STATE_READ_SAMPLE:
+			if (pin_is_high()) {
+				job->buf[async_byte_idx] |= async_bit_mask;
+			}
+			async_schedule(US_TO_TICKS(READ_REST_US));
+			async_state = STATE_SLOT_END;
+			return;
+		case STATE_SLOT_END:
+			// The bus should have recovered by the end of the slot
+			if (pin_is_low()) {
+				async_finish(DALLAS_ASYNC_BUS_ERROR);
+				return;
+			}
+			async_advance(job);
+			break;
+		case STATE_SLOT_START:
+			break;
+		default:
+			// Spurious interrupt
+			TIMSK1 &= ~TIMER_OCIE1A;
+			return;
+	}
+
+	// The previous slot's recovery time has passed; go straight into the next one
+	async_start_slot();
+}
+
+void dallas_async_setup(void) {
+	async_bus_high();
+	TIMSK1 &= ~TIMER_OCIE1A;
+	TCCR1A = TIMER_TCCR1A;
+	TCCR1B = TIMER_TCCR1B;
+	async_state = STATE_IDLE;
+	async_queue_head = 0;
+	async_queue_tail = 0;
+	dallas_async_status = DALLAS_ASYNC_IDLE;
+}
+
+static inline uint8_t async_queue_job(uint8_t type, uint8_t * buf, uint8_t len) {
+	DALLAS_ASYNC_JOB_t * job;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (QUEUE_COUNT() >= DALLAS_ASYNC_QUEUE_LEN - 1) return 1;
+		job = &async_queue[async_queue_tail];
+		job->type = type;
+		job->buf = buf;
+		job->len = len;
+		async_queue_tail = QUEUE_NEXT(async_queue_tail);
+	}
+	return 0;
+}
+
+uint8_t dallas_async_queue_reset(void) {
+	return async_queue_job(DALLAS_ASYNC_JOB_RESET, 0, 0);
+}
+
+uint8_t dallas_async_queue_write(uint8_t * buf, uint8_t len) {
+	return async_queue_job(DALLAS_ASYNC_JOB_WRITE, buf, len);
+}
+
+uint8_t dallas_async_queue_read(uint8_t * buf, uint8_t len) {
+	return async_queue_job(DALLAS_ASYNC_JOB_READ, buf, len);
+}
+
+uint8_t dallas_async_queue_match_rom(DALLAS_IDENTIFIER_t * identifier) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Queue all 3 or none
+		if (QUEUE_COUNT() + 3 > DALLAS_ASYNC_QUEUE_LEN - 1) return 1;
+		async_queue_job(DALLAS_ASYNC_JOB_RESET, 0, 0);
+		async_queue_job(DALLAS_ASYNC_JOB_WRITE, &async_match_rom_command, 1);
+		async_queue_job(DALLAS_ASYNC_JOB_WRITE, identifier->identifier, DALLAS_NUM_IDENTIFIER_BITS / 8);
+	}
+	return 0;
+}
+
+uint8_t dallas_async_queue_skip_rom(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (QUEUE_COUNT() + 2 > DALLAS_ASYNC_QUEUE_LEN - 1) return 1;
+		async_queue_job(DALLAS_ASYNC_JOB_RESET, 0, 0);
+		async_queue_job(DALLAS_ASYNC_JOB_WRITE, &async_skip_rom_command, 1);
+	}
+	return 0;
+}
+
+// Jobs queued while a run is in progress become part of that run.  If the run has
+// already finished, call this again.
+void dallas_async_start(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (async_state != STATE_IDLE) return;
+		if (async_queue_head == async_queue_tail) {
+			dallas_async_status = DALLAS_ASYNC_DONE;
+			return;
+		}
+		dallas_async_status = DALLAS_ASYNC_BUSY;
+		async_byte_idx = 0;
+		async_bit_mask = 0x01;
+		async_state = STATE_SLOT_START;
+		OCR1A = TCNT1 + US_TO_TICKS(START_DELAY_US);
+		TIFR1 = TIMER_OCF1A;
+		TIMSK1 |= TIMER_OCIE1A;
+	}
+}
+
+uint8_t dallas_async_busy(void) {
+	return dallas_async_status == DALLAS_ASYNC_BUSY;
+}
+
+void dallas_async_set_callback(void (*callback)(uint8_t status)) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		async_callback = callback;
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ * Interrupt-driven (non-blocking) 1-Wire master.
+ *
+ * Jobs (reset, write, read, match rom, skip rom) are queued and then run in the
+ * background from timer compare match interrupts, one timeslot phase per
+ * interrupt.  Interrupts are only held off for the few microseconds of each
+ * interrupt, instead of for the whole transaction.
+ *
+ * Uses the 16-bit Timer 1 with clk/8 and compare match A.  DALLAS_ASYNC_TIMER_VECT
+ * must be defined in one_wire_conf.h .  Needs an F_CPU of at least about 5 MHz
+ * (the build fails otherwise).  The slot timing is fixed: dallas_set_timing()
+ * and dallas_set_timing_profile() only apply to the polled master.
+ */
+
+#ifndef DALLAS_ONE_WIRE_ASYNC_H
+#define DALLAS_ONE_WIRE_ASYNC_H
+
+#include <stdint.h>
+#include "dallas_one_wire.h"
+
+// Maximum number of queued jobs (a match rom takes 3)
+#define DALLAS_ASYNC_QUEUE_LEN 8
+
+// Job types
+#define DALLAS_ASYNC_JOB_RESET 1
+#define DALLAS_ASYNC_JOB_WRITE 2
+#define DALLAS_ASYNC_JOB_READ 3
+
+// Values of dallas_async_status
+// No jobs have been run or the queue has been cleared
+#define DALLAS_ASYNC_IDLE 0
+// Jobs are running
+#define DALLAS_ASYNC_BUSY 1
+// All queued jobs finished successfully
+#define DALLAS_ASYNC_DONE 2
+// A slot was disturbed (bus was low when it should have been high)
+#define DALLAS_ASYNC_BUS_ERROR 3
+// No device answered a reset with a presence pulse
+#define DALLAS_ASYNC_NO_PRESENCE 4
+
+typedef struct {
+	uint8_t type;
+	uint8_t * buf;
+	uint8_t len;
+} DALLAS_ASYNC_JOB_t;
+
+// Status of the current (or last) run of jobs.  Once this leaves
+// DALLAS_ASYNC_BUSY the remaining queue has been flushed.
+extern volatile uint8_t dallas_async_status;
+
+// Initializes the timer.  Interrupts must be enabled globally by the caller.
+void dallas_async_setup(void);
+
+// Queue jobs.  Buffers must stay valid until the jobs finish.
+// These return nonzero if there isn't room in the queue.
+uint8_t dallas_async_queue_reset(void);
+uint8_t dallas_async_queue_write(uint8_t * buf, uint8_t len);
+uint8_t dallas_async_queue_read(uint8_t * buf, uint8_t len);
+// Queues a reset, MATCH ROM command, and the identifier
+uint8_t dallas_async_queue_match_rom(DALLAS_IDENTIFIER_t * identifier);
+// Queues a reset and SKIP ROM command
+uint8_t dallas_async_queue_skip_rom(void);
+
+// Starts running the queued jobs in the background
+void dallas_async_start(void);
+
+// Returns nonzero while jobs are running
+uint8_t dallas_async_busy(void);
+
+// Sets a function called (from interrupt context) when a run of jobs finishes
+// or fails.  The argument is the new dallas_async_status .  Can be null.
+void dallas_async_set_callback(void (*callback)(uint8_t status));
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Output compare slot backend for the 1-Wire master (DALLAS_BACKEND_OC).
+ *
+ * Instead of timing the low pulses with busy-wait delays, Timer 1 runs in fast
+ * PWM mode and the OC1B output drives an inverting transistor that pulls the bus
+ * low.  The hardware starts the pulse on the first timer tick and ends it on the
+ * compare match, so pulse widths are exact to the cycle.  The bus itself is wired
+ * to the ICP1 pin (DALLAS_PORT_IN/DALLAS_PIN), and the input capture unit
+ * timestamps the last rising edge of each slot.  Sampling a read slot is then
+ * just a comparison of that timestamp against the sample point.
+ *
+ * Interrupts are never disabled.  An interrupt during a slot can only lengthen
+ * the recovery time between slots, which the bus tolerates.
+ *
+ * Wiring (atmega328p): OC1B = PB2, ICP1 = PB0.
+ * Wiring (attiny44): OC1B = PA5, ICP1 = PA7.
+ *
+ * Uses Timer 1, so it can't be used with dallas_one_wire_async.c or with a slave
+ * using DALLAS_TIMER_1_16BIT.  dallas_drive_bus() is not supported because the
+ * transistor can only pull the bus low: it and dallas_write_byte_pullup() fail
+ * with DALLAS_ERR_UNSUPPORTED.
+ */
+
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "dallas_one_wire.h"
+
+#if DALLAS_BACKEND == DALLAS_BACKEND_OC
+
+#ifndef DALLAS_OC_PIN
+#error "DALLAS_OC_DDR, DALLAS_OC_PORT, and DALLAS_OC_PIN must be defined in one_wire_conf.h"
+#endif
+
+// Converts microseconds to timer ticks (timer runs at clk/1)
+#define US_TO_TICKS(us) ((uint16_t)(((uint32_t)(us) * F_CPU) / 1000000UL))
+
+// Slot timing in microseconds.  These match the GPIO backend.
+#define RESET_LOW_US 500
+#define RESET_REST_US 480
+// A rising edge this long after the reset pulse is the end of a presence pulse
+#define RESET_PRESENCE_MIN_US 15
+#define WRITE_0_LOW_US 60
+#define WRITE_0_REST_US 30
+#define WRITE_1_LOW_US 10
+#define WRITE_1_REST_US 50
+#define READ_LOW_US 2
+#define READ_SAMPLE_US 13
+#define READ_REST_US 45
+// Overdrive timing
+#define OD_RESET_LOW_US 70
+#define OD_RESET_REST_US 45
+#define OD_RESET_PRESENCE_MIN_US 2
+#define OD_WRITE_0_LOW_US 8
+#define OD_WRITE_0_REST_US 3
+#define OD_WRITE_1_LOW_US 1
+#define OD_WRITE_1_REST_US 9
+#define OD_READ_LOW_US 1
+#define OD_READ_SAMPLE_US 1
+#define OD_READ_REST_US 8
+
+#if (RESET_LOW_US + RESET_REST_US) * (F_CPU / 1000000UL) >= 0xFFFF
+#error "F_CPU is too high for the output compare backend"
+#endif
+
+// Timer register values
+// Fast PWM with TOP = OCR1A (mode 15).  OC1B is set at BOTTOM and cleared on
+// compare match, or disconnected.
+#define TIMER_TCCR1A_CONNECTED 0b00100011
+#define TIMER_TCCR1A_DISCONNECTED 0b00000011
+// Input capture noise canceler, capture on rising edge, mode 15, clk/1 or stopped
+#define TIMER_TCCR1B_RUNNING 0b11011001
+#define TIMER_TCCR1B_STOPPED 0b11011000
+// Flag bits in TIFR1
+#define TIMER_ICF1 0b00100000
+#define TIMER_OCF1B 0b00000100
+#define TIMER_TOP 0xFFFF
+
+#define pin_is_low() (!(DALLAS_PORT_IN & _BV(DALLAS_PIN)))
+#define pin_is_high() (DALLAS_PORT_IN & _BV(DALLAS_PIN))
+
+// Turns off the transistor, if it was forced on by dallas_hold_txn()
+static inline void oc_release() {
+	DALLAS_OC_PORT &= ~_BV(DALLAS_OC_PIN);
+}
+
+// Turns on the transistor outside of a timed pulse
+static inline void oc_hold() {
+	DALLAS_OC_PORT |= _BV(DALLAS_OC_PIN);
+}
+
+// Runs one slot.  The bus is pulled low from the first timer tick until
+// low_ticks, and the function returns at end_ticks.
+// Returns the time of the last rising edge on the bus, or 0 if there was none.
+uint16_t oc_slot(uint16_t low_ticks, uint16_t end_ticks) {
+	// The next tick wraps to BOTTOM, which loads OCR1B from its buffer and
+	// starts the pulse
+	TCNT1 = TIMER_TOP;
+	OCR1B = low_ticks;
+	TIFR1 = TIMER_ICF1 | TIMER_OCF1B;
+	TCCR1A = TIMER_TCCR1A_CONNECTED;
+	TCCR1B = TIMER_TCCR1B_RUNNING;
+	// The output compare unit owns the pin now
+	oc_release();
+
+	// Wait for the hardware to end the pulse, then for the rest of the slot
+	while (!(TIFR1 & TIMER_OCF1B));
+	while (TCNT1 < end_ticks);
+
+	TCCR1B = TIMER_TCCR1B_STOPPED;
+	TCCR1A = TIMER_TCCR1A_DISCONNECTED;
+
+	if (TIFR1 & TIMER_ICF1) return ICR1;
+	return 0;
+}
+
+void dallas_setup() {
+	// The transistor is off whenever the output compare unit is disconnected
+	oc_release();
+	DALLAS_OC_DDR |= _BV(DALLAS_OC_PIN);
+	// The bus is only ever read directly
+	DALLAS_DDR &= ~_BV(DALLAS_PIN);
+	DALLAS_PORT &= ~_BV(DALLAS_PIN);
+	// OCR1A (TOP) is written in normal mode, where it isn't double buffered
+	TCCR1B = 0;
+	TCCR1A = 0;
+	OCR1A = TIMER_TOP;
+	TCCR1A = TIMER_TCCR1A_DISCONNECTED;
+	TCCR1B = TIMER_TCCR1B_STOPPED;
+}
+
+// Can set dallas_bus_error flag
+void dallas_write(uint8_t bit) {
+	// Make sure the bus is high
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return; }
+
+	if (dallas_speed == DALLAS_SPEED_OVERDRIVE) {
+		if (bit) {
+			oc_slot(US_TO_TICKS(OD_WRITE_1_LOW_US), US_TO_TICKS(OD_WRITE_1_LOW_US + OD_WRITE_1_REST_US));
+		} else {
+			oc_slot(US_TO_TICKS(OD_WRITE_0_LOW_US), US_TO_TICKS(OD_WRITE_0_LOW_US + OD_WRITE_0_REST_US));
+		}
+	} else if (bit) {
+		oc_slot(US_TO_TICKS(WRITE_1_LOW_US), US_TO_TICKS(WRITE_1_LOW_US + WRITE_1_REST_US));
+	} else {
+		oc_slot(US_TO_TICKS(WRITE_0_LOW_US), US_TO_TICKS(WRITE_0_LOW_US + WRITE_0_REST_US));
+	}
+
+	// The bus should have recovered by the end of the slot
+	if (pin_is_low()) dallas_bus_error = DALLAS_ERR_SHORT;
+}
+
+// Returns 0 or 1 on success
+// Sets dallas_bus_error flag
+uint8_t dallas_read(void) {
+	uint16_t edge;
+	uint16_t sample;
+
+	// Make sure the bus is high
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return 0; }
+
+	if (dallas_speed == DALLAS_SPEED_OVERDRIVE) {
+		edge = oc_slot(US_TO_TICKS(OD_READ_LOW_US), US_TO_TICKS(OD_READ_LOW_US + OD_READ_SAMPLE_US + OD_READ_REST_US));
+		sample = US_TO_TICKS(OD_READ_LOW_US + OD_READ_SAMPLE_US);
+	} else {
+		edge = oc_slot(US_TO_TICKS(READ_LOW_US), US_TO_TICKS(READ_LOW_US + READ_SAMPLE_US + READ_REST_US));
+		sample = US_TO_TICKS(READ_LOW_US + READ_SAMPLE_US);
+	}
+
+	// The bus should have recovered by the end of the slot
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_SHORT; return 0; }
+
+	// A 1 bit lets the bus rise as soon as we release it.  A 0 bit holds it low
+	// past the sample point.
+	if (edge && edge < sample) {
+		return 0x01;
+	}
+	return 0x00;
+}
+
+// Resets the bus and returns 0x01 if a slave indicates present, 0x00 otherwise.
+// Can set dallas_bus_error flag
+uint8_t dallas_reset(void) {
+	uint16_t edge;
+	uint16_t presence;
+
+	// Unset bus error
+	dallas_bus_error = 0;
+
+	if (dallas_speed == DALLAS_SPEED_OVERDRIVE) {
+		edge = oc_slot(US_TO_TICKS(OD_RESET_LOW_US), US_TO_TICKS(OD_RESET_LOW_US + OD_RESET_REST_US));
+		presence = US_TO_TICKS(OD_RESET_LOW_US + OD_RESET_PRESENCE_MIN_US);
+	} else {
+		edge = oc_slot(US_TO_TICKS(RESET_LOW_US), US_TO_TICKS(RESET_LOW_US + RESET_REST_US));
+		presence = US_TO_TICKS(RESET_LOW_US + RESET_PRESENCE_MIN_US);
+	}
+
+	// The bus should have recovered by the end of the slot
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_SHORT; return 0; }
+
+	// The last rising edge is the end of the presence pulse if there was one,
+	// otherwise it's the end of our reset pulse
+	if (edge > presence) {
+		return 0x01;
+	}
+	return 0x00;
+}
+
+// Not supported by this backend (see above).  Just releases the bus.
+void dallas_drive_bus(void) {
+	oc_release();
+	dallas_bus_error = DALLAS_ERR_UNSUPPORTED;
+}
+
+void dallas_release_bus(void) {
+	oc_release();
+}
+
+void dallas_hold_txn() {
+	dallas_bus_error = 0;
+	oc_hold();
+}
+
+void dallas_begin_txn() {
+	dallas_bus_error = 0;
+	oc_release();
+	if (dallas_arbitrate()) {
+		dallas_bus_error = DALLAS_ERR_TXN_TIMEOUT;
+		return;
+	}
+	dallas_hold_txn();
+}
+
+void dallas_end_txn() {
+	dallas_bus_error = 0;
+	oc_release();
+}
+
+#endif
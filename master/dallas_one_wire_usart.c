@@ -0,0 +1,248 @@
+/*
+ * USART slot backend for the 1-Wire master (DALLAS_BACKEND_USART).
+ *
+ * Each timeslot is one byte sent by USART0, and the bit is read back from the
+ * byte received at the same time.  TXD drives the bus through an open-drain
+ * buffer and RXD (DALLAS_PORT_IN/DALLAS_PIN) is connected to the bus directly.
+ *
+ * At 115200 baud the start bit is the low pulse of the slot:
+ * - Write 1 / read: send 0xFF.  A 1 bit echoes as 0xFF.  A slave sending a 0
+ *   holds the bus low into the data bits, so the echo is something else.
+ * - Write 0: send 0x00.  This holds the bus low for ~78 us.
+ * Resets are sent at 9600 baud as 0xF0 (the low nibble and start bit form a
+ * ~520 us low pulse).  A presence pulse corrupts the echoed high nibble.
+ *
+ * The USART does all bit timing, so interrupts are never disabled.  Whole bytes
+ * are pipelined through the transmit buffer, so the 8 slots of a byte run back
+ * to back.
+ *
+ * Requires a part with USART0 (ie, the atmega328p).  It can't be used when USART0
+ * is needed for something else (like serial1wire's console).
+ * dallas_drive_bus() is not supported because the buffer can only pull the bus
+ * low: it and dallas_write_byte_pullup() fail with DALLAS_ERR_UNSUPPORTED.  Neither is overdrive: the overdrive ROM commands fail with
+ * DALLAS_ERR_UNSUPPORTED without touching the bus, and so does a reset while
+ * dallas_speed is DALLAS_SPEED_OVERDRIVE.
+ */
+
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "dallas_one_wire.h"
+
+#if DALLAS_BACKEND == DALLAS_BACKEND_USART
+
+#ifndef DALLAS_USART_TX_PIN
+#error "DALLAS_USART_TX_DDR, DALLAS_USART_TX_PORT, and DALLAS_USART_TX_PIN must be defined in one_wire_conf.h"
+#endif
+
+// Baud rates for resets and for slots
+#define RESET_BAUD 9600UL
+#define SLOT_BAUD 115200UL
+
+// UBRR values in double speed mode, rounded to nearest
+#define BAUD_TO_UBRR(baud) ((uint16_t)((F_CPU + (baud) * 4UL) / ((baud) * 8UL) - 1UL))
+
+// Bytes sent for each kind of slot
+#define RESET_BYTE 0xF0
+#define WRITE_0_BYTE 0x00
+#define WRITE_1_BYTE 0xFF
+#define READ_BYTE 0xFF
+
+// Number of polling iterations to wait for an echo before giving up.  This is
+// much longer than a reset byte at any supported F_CPU.
+#define ECHO_TIMEOUT 60000
+
+// Register bits
+#define USART_RXC 0b10000000
+#define USART_UDRE 0b00100000
+#define USART_U2X 0b00000010
+// Receiver and transmitter enabled
+#define USART_UCSRB_ON 0b00011000
+// Receiver only (transmitter pin reverts to a normal port pin)
+#define USART_UCSRB_RX_ONLY 0b00010000
+// Asynchronous, 8 data bits, no parity, 1 stop bit
+#define USART_UCSRC 0b00000110
+
+#define pin_is_low() (!(DALLAS_PORT_IN & _BV(DALLAS_PIN)))
+
+static inline void usart_set_baud(uint16_t ubrr) {
+	// Let any byte in progress finish first
+	while (!(UCSR0A & USART_UDRE));
+	UBRR0 = ubrr;
+}
+
+static inline void usart_flush_rx() {
+	uint8_t dummy;
+	while (UCSR0A & USART_RXC) {
+		dummy = UDR0;
+	}
+	(void)dummy;
+}
+
+// Waits for and returns the next received byte.  Sets dallas_bus_error to
+// DALLAS_ERR_SHORT and returns 0 if nothing arrives.
+static inline uint8_t usart_receive() {
+	uint16_t timeout;
+	for (timeout = ECHO_TIMEOUT; timeout; --timeout) {
+		if (UCSR0A & USART_RXC) return UDR0;
+	}
+	dallas_bus_error = DALLAS_ERR_SHORT;
+	return 0;
+}
+
+// Sends one slot byte and returns its echo
+uint8_t usart_slot(uint8_t b) {
+	usart_flush_rx();
+	while (!(UCSR0A & USART_UDRE));
+	UDR0 = b;
+	return usart_receive();
+}
+
+// Runs the 8 slots of a byte back to back.  Each entry of slots is the byte to
+// send for that slot, and is replaced with its echo.
+void usart_slots(uint8_t * slots) {
+	uint8_t sent = 0;
+	uint8_t received = 0;
+	usart_flush_rx();
+	// The transmit buffer holds one byte while another is shifting out, so keep
+	// it full and collect echoes as they arrive
+	while (received < 8) {
+		if (sent < 8 && (UCSR0A & USART_UDRE) && sent - received < 2) {
+			UDR0 = slots[sent++];
+		}
+		if (sent > received) {
+			if (UCSR0A & USART_RXC) {
+				slots[received++] = UDR0;
+			} else if (sent - received >= 2 || sent == 8) {
+				slots[received++] = usart_receive();
+				if (dallas_bus_error) return;
+			}
+		}
+	}
+}
+
+void dallas_setup() {
+	// While the transmitter is disabled, the TX pin releases the bus
+	DALLAS_USART_TX_PORT |= _BV(DALLAS_USART_TX_PIN);
+	DALLAS_USART_TX_DDR |= _BV(DALLAS_USART_TX_PIN);
+	// RXD is only read
+	DALLAS_DDR &= ~_BV(DALLAS_PIN);
+	DALLAS_PORT &= ~_BV(DALLAS_PIN);
+	UCSR0A = USART_U2X;
+	UCSR0C = USART_UCSRC;
+	UBRR0 = BAUD_TO_UBRR(SLOT_BAUD);
+	UCSR0B = USART_UCSRB_ON;
+}
+
+// Can set dallas_bus_error flag
+void dallas_write(uint8_t bit) {
+	uint8_t sent = bit ? WRITE_1_BYTE : WRITE_0_BYTE;
+	// Make sure the bus is high
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return; }
+	// Anything else means someone else pulled the bus low during the slot
+	if (usart_slot(sent) != sent) dallas_bus_error = DALLAS_ERR_EARLY_LOW;
+}
+
+// Returns 0 or 1 on success
+// Sets dallas_bus_error flag
+uint8_t dallas_read(void) {
+	// Make sure the bus is high
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return 0; }
+	return (usart_slot(READ_BYTE) == READ_BYTE) ? 0x01 : 0x00;
+}
+
+void dallas_write_byte(uint8_t byte) {
+	uint8_t slots[8];
+	uint8_t i;
+
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return; }
+	for (i = 0; i < 8; i++) {
+		slots[i] = (byte & _BV(i)) ? WRITE_1_BYTE : WRITE_0_BYTE;
+	}
+	usart_slots(slots);
+	if (dallas_bus_error) return;
+	for (i = 0; i < 8; i++) {
+		if (slots[i] != ((byte & _BV(i)) ? WRITE_1_BYTE : WRITE_0_BYTE)) {
+			dallas_bus_error = DALLAS_ERR_EARLY_LOW;
+			return;
+		}
+	}
+}
+
+uint8_t dallas_read_byte(void) {
+	uint8_t slots[8];
+	uint8_t byte = 0;
+	uint8_t i;
+
+	if (pin_is_low()) { dallas_bus_error = DALLAS_ERR_BUS_LOW; return 0; }
+	for (i = 0; i < 8; i++) {
+		slots[i] = READ_BYTE;
+	}
+	usart_slots(slots);
+	if (dallas_bus_error) return 0;
+	for (i = 0; i < 8; i++) {
+		if (slots[i] == READ_BYTE) byte |= _BV(i);
+	}
+	return byte;
+}
+
+// Resets the bus and returns 0x01 if a slave indicates present, 0x00 otherwise.
+// Can set dallas_bus_error flag
+uint8_t dallas_reset(void) {
+	uint8_t echo;
+
+	// Unset bus error
+	dallas_bus_error = 0;
+
+	// Only standard speed slots are supported
+	if (dallas_speed != DALLAS_SPEED_STANDARD) { dallas_bus_error = DALLAS_ERR_UNSUPPORTED; return 0; }
+
+	// Make sure the transmitter owns the pin (it may be held by a transaction)
+	UCSR0B = USART_UCSRB_ON;
+
+	usart_set_baud(BAUD_TO_UBRR(RESET_BAUD));
+	echo = usart_slot(RESET_BYTE);
+	usart_set_baud(BAUD_TO_UBRR(SLOT_BAUD));
+	if (dallas_bus_error) return 0;
+
+	// Bus never came back up
+	if (echo == 0x00) { dallas_bus_error = DALLAS_ERR_SHORT; return 0; }
+
+	return (echo != RESET_BYTE) ? 0x01 : 0x00;
+}
+
+// Not supported by this backend (see above).  Just releases the bus.
+void dallas_drive_bus(void) {
+	DALLAS_USART_TX_PORT |= _BV(DALLAS_USART_TX_PIN);
+	dallas_bus_error = DALLAS_ERR_UNSUPPORTED;
+}
+
+void dallas_release_bus(void) {
+	DALLAS_USART_TX_PORT |= _BV(DALLAS_USART_TX_PIN);
+}
+
+void dallas_hold_txn() {
+	dallas_bus_error = 0;
+	// Every slot waits for its echo, so the transmitter is idle here.  Take the
+	// pin from it and hold the bus low.
+	DALLAS_USART_TX_PORT &= ~_BV(DALLAS_USART_TX_PIN);
+	UCSR0B = USART_UCSRB_RX_ONLY;
+}
+
+void dallas_begin_txn() {
+	dallas_end_txn();
+	if (dallas_arbitrate()) {
+		dallas_bus_error = DALLAS_ERR_TXN_TIMEOUT;
+		return;
+	}
+	dallas_hold_txn();
+}
+
+void dallas_end_txn() {
+	dallas_bus_error = 0;
+	DALLAS_USART_TX_PORT |= _BV(DALLAS_USART_TX_PIN);
+	UCSR0B = USART_UCSRB_ON;
+}
+
+#endif
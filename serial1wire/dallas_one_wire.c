@@ -0,0 +1 @@
+../master/dallas_one_wire.c
\ No newline at end of file
@@ -0,0 +1 @@
+../master/dallas_one_wire.h
\ No newline at end of file
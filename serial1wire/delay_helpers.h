@@ -0,0 +1 @@
+../master/delay_helpers.h
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef ONE_WIRE_CONF_H
+#define ONE_WIRE_CONF_H
+
+// Master settings for serial1wire (atmega328p at 16 MHz).  See
+// slave/one_wire_conf.h for all of the options.
+
+// IO port for bus
+#define DALLAS_PORT PORTC
+
+// Input register for DALLAS_PORT
+#define DALLAS_PORT_IN PINC
+
+// Data direction register for DALLAS_PORT
+#define DALLAS_DDR DDRC
+
+// Pin number on the port
+#define DALLAS_PIN 4
+
+// Timeslot tracing, dumped by the 'L' command.  Timer 1 runs free at clk/8, so
+// the timestamps are in 0.5 us.
+#define DALLAS_TRACE
+#define OW_TRACE_LEN 64
+#define OW_TRACE_CLOCK() TCNT1
+
+#endif
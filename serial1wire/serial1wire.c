@@ -1,9 +1,9 @@
-#include "./dallas_one_wire.h"
 //#define F_CPU 16000000
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
 #include <stdio.h>
+#include "./dallas_one_wire.h"
 
 void writeStr(char *str) {
 	int i;
@@ -72,6 +72,29 @@ uint8_t resultBuf[512];
 uint16_t resultBufPos = 0;
 DALLAS_IDENTIFIER_t currentIdentifier;
 
+#ifdef DALLAS_TRACE
+// Writes the master's trace, oldest first, one record per line:
+// time type value recovery
+void writeTrace() {
+	uint8_t i;
+	OW_TRACE_t * trace = get_dallas_trace();
+	OW_TRACE_RECORD_t * record;
+	for (i = 0; i < ow_trace_count(trace); i++) {
+		record = ow_trace_get(trace, i);
+		writeHex(record->time >> 8);
+		writeHex(record->time & 0xFF);
+		writeStr(" ");
+		writeHex(record->type);
+		writeStr(" ");
+		writeHex(record->value);
+		writeStr(" ");
+		writeHex(record->recovery);
+		writeStr("\r\n");
+	}
+	ow_trace_clear(trace);
+}
+#endif
+
 void runCmd(unsigned char cmd, uint8_t * data, uint16_t datalen) {
 	uint16_t i, j;
 	uint8_t curResult;
@@ -142,6 +165,12 @@ void runCmd(unsigned char cmd, uint8_t * data, uint16_t datalen) {
 				resultBuf[resultBufPos++] = dallas_read_byte();
 			}
 			break;
+#ifdef DALLAS_TRACE
+		case 'L':
+			writeStr("Trace:\r\n");
+			writeTrace();
+			break;
+#endif
 /*		case 'T':
 			writeStr("Starting test\r\n");
 			dallas_search_identifiers();
@@ -276,6 +305,13 @@ int main(void) {
 	// 8 data bits, 1 stop bit, no parity
 	UCSR0B = 0b00011000;
 	UCSR0C = 0b00000110;
+
+	dallas_setup();
+#ifdef DALLAS_TRACE
+	// Timer 1 free running at clk/8, for the trace timestamps
+	TCCR1A = 0;
+	TCCR1B = 0b00000010;
+#endif
 	sei();
 	writeStr("Ready.\r\n");
 
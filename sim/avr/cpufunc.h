@@ -0,0 +1,11 @@
+// Stand-in for <avr/cpufunc.h> in the host simulation.  See sim/sim.h .
+
+#ifndef SIM_AVR_CPUFUNC_H
+#define SIM_AVR_CPUFUNC_H
+
+#include "../sim.h"
+
+#define _NOP() sim_cycles(1)
+#define _MemoryBarrier() __asm__ __volatile__("" ::: "memory")
+
+#endif
@@ -0,0 +1,13 @@
+// Stand-in for <avr/eeprom.h> in the host simulation.  See sim/sim.h .
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include "../sim.h"
+
+#define eeprom_read_block(dst, src, len) sim_eeprom_read((dst), (uintptr_t)(src), (len))
+#define eeprom_write_block(src, dst, len) sim_eeprom_write((src), (uintptr_t)(dst), (len))
+#define eeprom_update_block(src, dst, len) sim_eeprom_write((src), (uintptr_t)(dst), (len))
+
+#endif
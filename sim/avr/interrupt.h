@@ -0,0 +1,16 @@
+// Stand-in for <avr/interrupt.h> in the host simulation.  See sim/sim.h .
+//
+// ISR(vect) defines sim_isr_<vect>(), which sim_slave.c hands to the simulator.
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "../sim.h"
+
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define ISR(vect) SIM_ISR_NAME(vect)
+#define SIM_ISR_NAME(vect) void sim_isr_ ## vect(void)
+
+#endif
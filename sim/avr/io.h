@@ -0,0 +1,47 @@
+// Stand-in for <avr/io.h> in the host simulation.  See sim/sim.h .
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "../sim.h"
+
+#define _BV(bit) (1 << (bit))
+// Only used by the inline assembly in delay_helpers.h, which isn't built here
+#define _SFR_IO_ADDR(reg) 0
+#define __builtin_avr_delay_cycles(cycles) sim_cycles(cycles)
+
+#define PINA (*sim_io(SIM_PINA))
+#define DDRA (*sim_io(SIM_DDRA))
+#define PORTA (*sim_io(SIM_PORTA))
+#define PINB (*sim_io(SIM_PINB))
+#define DDRB (*sim_io(SIM_DDRB))
+#define PORTB (*sim_io(SIM_PORTB))
+#define PINC (*sim_io(SIM_PINC))
+#define DDRC (*sim_io(SIM_DDRC))
+#define PORTC (*sim_io(SIM_PORTC))
+#define PIND (*sim_io(SIM_PIND))
+#define DDRD (*sim_io(SIM_DDRD))
+#define PORTD (*sim_io(SIM_PORTD))
+#define SREG (*sim_io(SIM_SREG))
+#define GIMSK (*sim_io(SIM_GIMSK))
+#define GIFR (*sim_io(SIM_GIFR))
+#define PCMSK0 (*sim_io(SIM_PCMSK0))
+#define TCCR0A (*sim_io(SIM_TCCR0A))
+#define TCCR0B (*sim_io(SIM_TCCR0B))
+#define TCNT0 (*sim_io(SIM_TCNT0))
+#define OCR0A (*sim_io(SIM_OCR0A))
+#define OCR0B (*sim_io(SIM_OCR0B))
+#define TIMSK0 (*sim_io(SIM_TIMSK0))
+#define TIFR0 (*sim_io(SIM_TIFR0))
+#define TCCR1A (*sim_io(SIM_TCCR1A))
+#define TCCR1B (*sim_io(SIM_TCCR1B))
+#define TCCR1C (*sim_io(SIM_TCCR1C))
+#define TIMSK1 (*sim_io(SIM_TIMSK1))
+#define TIFR1 (*sim_io(SIM_TIFR1))
+#define TCNT1 (*sim_io16(SIM_TCNT1))
+#define OCR1A (*sim_io16(SIM_OCR1A))
+#define OCR1B (*sim_io16(SIM_OCR1B))
+#define ICR1 (*sim_io16(SIM_ICR1))
+
+#endif
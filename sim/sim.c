@@ -0,0 +1,613 @@
+/*
+ * Host (Linux) simulation HAL.  See sim.h .
+ */
+
+#define _GNU_SOURCE
+// Devices switch stacks with _longjmp(), which the fortified version refuses to do
+#undef _FORTIFY_SOURCE
+#include <dlfcn.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+// Bus pin on port A (from the force-included one_wire_conf.h)
+#define BUS_BIT (1 << DALLAS_PIN)
+
+#define STACK_SIZE (256 * 1024)
+
+#define SREG_I 0x80
+// Flag and enable bits
+#define PCIF (1 << DALLAS_GIFR_BIT)
+#define PCIE (1 << DALLAS_GIMSK_BIT)
+#define OCF_A 0x02
+#define OCIE_A 0x02
+// CTC mode bits (WGM01 in TCCR0A, WGM12 in TCCR1B)
+#define TIMER0_CTC 0x02
+#define TIMER1_CTC 0x08
+// Cycles to enter and to return from an interrupt
+#define ISR_ENTER_CYCLES 4
+#define ISR_RETURN_CYCLES 4
+// Reads of the bus in a row that make a busy-wait (see sim_io())
+#define SPIN_READS 8
+
+#define STATE_RUNNABLE 0
+#define STATE_SLEEPING 1
+#define STATE_DONE 2
+
+struct SIM_DEVICE {
+	char name[32];
+	uint64_t cycle_ps;
+	uint64_t time;
+	uint8_t state;
+	// When to wake up, while sleeping
+	uint64_t wake;
+	volatile uint8_t regs[SIM_NUM_REGS];
+	volatile uint16_t regs16[SIM_NUM_REGS16];
+	uint8_t eeprom[SIM_EEPROM_LEN];
+
+	void (*entry)(void);
+	void (*isr_pcint0)(void);
+	void (*isr_tim0_compa)(void);
+	void (*isr_tim1_compa)(void);
+	// The device's stack, entered with setcontext() the first time and with
+	// _longjmp() (which skips the signal mask syscall) after that
+	ucontext_t context;
+	void * stack;
+	uint8_t started;
+	jmp_buf env;
+
+	// What the device is doing to the bus, and the bus level it last saw
+	uint8_t drives_low;
+	uint8_t drives_high;
+	uint8_t level;
+	// Number of reads of the bus in a row that found it at spin_level, with
+	// nothing else in between
+	uint8_t spin_reads;
+	uint8_t spin_level;
+	// Cycle count the timers were last advanced to
+	uint64_t timer_cycles;
+	uint8_t timers_stopped;
+	// Interrupt enable as last seen, and when interrupts were disabled
+	uint8_t irq_enabled;
+	uint8_t irq_ever_enabled;
+	uint64_t irq_off_since;
+	SIM_DEVICE_STATS_t stats;
+
+	SIM_DEVICE_t * next;
+};
+
+SIM_DEVICE_t * devices = 0;
+SIM_DEVICE_t * last_device = 0;
+// Device whose coroutine is running, or null in the scheduler
+SIM_DEVICE_t * current = 0;
+jmp_buf scheduler_env;
+// No other device is behind this time, so the current device can run up to it
+uint64_t horizon;
+
+SIM_BUS_t bus = { 0, 0, 1000000ULL };
+// Number of devices pulling the bus low, and driving it high
+uint16_t bus_low_count = 0;
+uint16_t bus_high_count = 0;
+// When the bus was last let go
+uint64_t bus_release_time = 0;
+
+const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+void sim_fatal(const char * msg) {
+	fprintf(stderr, "sim: %s\n", msg);
+	exit(2);
+}
+
+uint8_t bus_level(uint64_t time) {
+	if (bus_low_count) return 0;
+	if (bus_high_count) return 1;
+	return time >= bus_release_time + bus.rise_ps;
+}
+
+// Wakes sleeping devices (other than the current one) by time, so they can
+// look at the bus
+void wake_sleepers(uint64_t time) {
+	SIM_DEVICE_t * d;
+	for (d = devices; d; d = d->next) {
+		if (d == current || d->state != STATE_SLEEPING) continue;
+		if (time < d->wake) d->wake = time;
+		if (d->wake < horizon) horizon = d->wake;
+	}
+}
+
+// Latches a falling edge into the other devices' pin change flag, even if they
+// are in the middle of a delay and never see the bus low
+void latch_falling_edge(void) {
+	SIM_DEVICE_t * d;
+	for (d = devices; d; d = d->next) {
+		if (d == current) continue;
+		d->level = 0;
+		if (d->regs[SIM_PCMSK0] & BUS_BIT) d->regs[SIM_GIFR] |= PCIF;
+	}
+}
+
+// Applies the device's last port writes to the bus, at the device's time
+void update_drive(SIM_DEVICE_t * dev) {
+	uint8_t ddr = dev->regs[SIM_DDRA] & BUS_BIT;
+	uint8_t port = dev->regs[SIM_PORTA] & BUS_BIT;
+	uint8_t low = ddr && !port;
+	uint8_t high = ddr && port;
+	uint8_t was_low = bus_low_count ? 1 : 0;
+
+	if (low == dev->drives_low && high == dev->drives_high) return;
+	bus_low_count += (int)low - (int)dev->drives_low;
+	bus_high_count += (int)high - (int)dev->drives_high;
+	dev->drives_low = low;
+	dev->drives_high = high;
+	if (bus_low_count && bus_high_count) bus.contentions++;
+
+	if (!was_low && bus_low_count) {
+		bus.falling_edges++;
+		latch_falling_edge();
+		wake_sleepers(dev->time);
+	} else if (was_low && !bus_low_count) {
+		bus_release_time = dev->time;
+		wake_sleepers(bus_high_count ? dev->time : dev->time + bus.rise_ps);
+	} else if (!bus_low_count) {
+		// Started or stopped driving it high
+		wake_sleepers(dev->time);
+	}
+}
+
+// Advances a timer by ticks.  Counts up to top then back to 0 (values above top
+// count up to max first).  Returns 1 if the count passed through ocr.
+uint8_t timer_advance(volatile uint16_t * count, uint32_t top, uint32_t max, uint32_t ocr, uint64_t ticks) {
+	uint32_t cnt = *count;
+	uint32_t wrap_at;
+	uint64_t to_wrap;
+	uint8_t matched = 0;
+
+	while (ticks) {
+		wrap_at = (cnt <= top) ? top : max;
+		to_wrap = (uint64_t)(wrap_at - cnt) + 1;
+		if (ticks < to_wrap) {
+			if (ocr > cnt && ocr <= cnt + ticks) matched = 1;
+			cnt += ticks;
+			break;
+		}
+		if ((ocr > cnt && ocr <= wrap_at) || ocr == 0) matched = 1;
+		cnt = 0;
+		ticks -= to_wrap;
+		// Whole periods from 0
+		if (ticks > top) {
+			if (ocr <= top) matched = 1;
+			ticks %= (uint64_t)top + 1;
+		}
+	}
+	*count = cnt;
+	return matched;
+}
+
+// Ticks from count until the count reaches ocr, or 0 if it never will
+uint64_t timer_ticks_to_match(uint32_t cnt, uint32_t top, uint32_t max, uint32_t ocr) {
+	uint32_t wrap_at = (cnt <= top) ? top : max;
+	if (ocr > cnt && ocr <= wrap_at) return ocr - cnt;
+	if (ocr > top) return 0;
+	return (uint64_t)(wrap_at - cnt) + 1 + ocr;
+}
+
+void update_timers(SIM_DEVICE_t * dev) {
+	uint64_t cycles;
+	uint16_t prescale;
+	uint16_t count;
+
+	// Skip the division while both timers are stopped
+	if (!(dev->regs[SIM_TCCR0B] & 0x07) && !(dev->regs[SIM_TCCR1B] & 0x07)) {
+		dev->timers_stopped = 1;
+		return;
+	}
+	cycles = dev->time / dev->cycle_ps;
+	if (dev->timers_stopped) {
+		dev->timers_stopped = 0;
+		dev->timer_cycles = cycles;
+		return;
+	}
+	if (cycles <= dev->timer_cycles) return;
+
+	prescale = prescalers[dev->regs[SIM_TCCR0B] & 0x07];
+	if (prescale) {
+		count = dev->regs[SIM_TCNT0];
+		if (timer_advance(&count, (dev->regs[SIM_TCCR0A] & TIMER0_CTC) ? dev->regs[SIM_OCR0A] : 0xFF, 0xFF,
+				dev->regs[SIM_OCR0A], cycles / prescale - dev->timer_cycles / prescale)) {
+			dev->regs[SIM_TIFR0] |= OCF_A;
+		}
+		dev->regs[SIM_TCNT0] = (uint8_t)count;
+	}
+
+	prescale = prescalers[dev->regs[SIM_TCCR1B] & 0x07];
+	if (prescale) {
+		if (timer_advance(&dev->regs16[SIM_TCNT1], (dev->regs[SIM_TCCR1B] & TIMER1_CTC) ? dev->regs16[SIM_OCR1A] : 0xFFFF, 0xFFFF,
+				dev->regs16[SIM_OCR1A], cycles / prescale - dev->timer_cycles / prescale)) {
+			dev->regs[SIM_TIFR1] |= OCF_A;
+		}
+	}
+
+	dev->timer_cycles = cycles;
+}
+
+// Time of the next timer interrupt that could wake the device, or SIM_NEVER
+uint64_t next_timer_event(SIM_DEVICE_t * dev) {
+	uint64_t next = SIM_NEVER;
+	uint64_t ticks;
+	uint64_t at;
+	uint16_t prescale;
+
+	prescale = prescalers[dev->regs[SIM_TCCR0B] & 0x07];
+	if (prescale && (dev->regs[SIM_TIMSK0] & OCIE_A)) {
+		ticks = timer_ticks_to_match(dev->regs[SIM_TCNT0], (dev->regs[SIM_TCCR0A] & TIMER0_CTC) ? dev->regs[SIM_OCR0A] : 0xFF, 0xFF, dev->regs[SIM_OCR0A]);
+		if (ticks) {
+			at = (dev->timer_cycles / prescale + ticks) * prescale * dev->cycle_ps;
+			if (at < next) next = at;
+		}
+	}
+	prescale = prescalers[dev->regs[SIM_TCCR1B] & 0x07];
+	if (prescale && (dev->regs[SIM_TIMSK1] & OCIE_A)) {
+		ticks = timer_ticks_to_match(dev->regs16[SIM_TCNT1], (dev->regs[SIM_TCCR1B] & TIMER1_CTC) ? dev->regs16[SIM_OCR1A] : 0xFFFF, 0xFFFF, dev->regs16[SIM_OCR1A]);
+		if (ticks) {
+			at = (dev->timer_cycles / prescale + ticks) * prescale * dev->cycle_ps;
+			if (at < next) next = at;
+		}
+	}
+	return next;
+}
+
+// Keeps track of how long interrupts are disabled
+void update_irq_stats(SIM_DEVICE_t * dev, uint8_t enabled) {
+	uint64_t off;
+	if (enabled == dev->irq_enabled) return;
+	dev->irq_enabled = enabled;
+	if (!enabled) {
+		dev->irq_off_since = dev->time;
+	} else if (dev->irq_ever_enabled) {
+		off = dev->time - dev->irq_off_since;
+		dev->stats.irq_off_ps += off;
+		if (off > dev->stats.irq_off_max_ps) dev->stats.irq_off_max_ps = off;
+	} else {
+		dev->irq_ever_enabled = 1;
+	}
+}
+
+void yield(void) {
+	if (!_setjmp(current->env)) _longjmp(scheduler_env, 1);
+}
+
+void run_isr(SIM_DEVICE_t * dev, void (*isr)(void)) {
+	dev->stats.interrupts++;
+	dev->regs[SIM_SREG] &= ~SREG_I;
+	update_irq_stats(dev, 0);
+	dev->time += ISR_ENTER_CYCLES * dev->cycle_ps;
+	isr();
+	dev->time += ISR_RETURN_CYCLES * dev->cycle_ps;
+	dev->regs[SIM_SREG] |= SREG_I;
+	update_irq_stats(dev, 1);
+}
+
+// Brings the current device up to date after spending cycles.  Applies its last
+// writes to the bus, waits for the other devices to catch up, then updates the
+// timers and pin change flag and takes any pending interrupts.
+void device_sync(uint64_t cycles) {
+	SIM_DEVICE_t * dev = current;
+	uint8_t level;
+
+	update_drive(dev);
+	// Interrupts were enabled or disabled by the last access, before these cycles
+	update_irq_stats(dev, dev->regs[SIM_SREG] & SREG_I);
+	dev->time += cycles * dev->cycle_ps;
+	if (dev->time > horizon) yield();
+
+	update_timers(dev);
+	level = bus_level(dev->time);
+	if (level != dev->level) {
+		dev->level = level;
+		if (dev->regs[SIM_PCMSK0] & BUS_BIT) dev->regs[SIM_GIFR] |= PCIF;
+	}
+	update_irq_stats(dev, dev->regs[SIM_SREG] & SREG_I);
+
+	while (dev->regs[SIM_SREG] & SREG_I) {
+		if ((dev->regs[SIM_GIFR] & PCIF) && (dev->regs[SIM_GIMSK] & PCIE) && dev->isr_pcint0) {
+			dev->regs[SIM_GIFR] &= ~PCIF;
+			run_isr(dev, dev->isr_pcint0);
+		} else if ((dev->regs[SIM_TIFR1] & OCF_A) && (dev->regs[SIM_TIMSK1] & OCIE_A) && dev->isr_tim1_compa) {
+			dev->regs[SIM_TIFR1] &= ~OCF_A;
+			run_isr(dev, dev->isr_tim1_compa);
+		} else if ((dev->regs[SIM_TIFR0] & OCF_A) && (dev->regs[SIM_TIMSK0] & OCIE_A) && dev->isr_tim0_compa) {
+			dev->regs[SIM_TIFR0] &= ~OCF_A;
+			run_isr(dev, dev->isr_tim0_compa);
+		} else {
+			break;
+		}
+	}
+}
+
+// Time the device could next see the bus change on its own: the end of a rise in
+// progress, or a timer interrupt
+uint64_t next_event(SIM_DEVICE_t * dev, uint64_t wake) {
+	uint64_t rise = bus_release_time + bus.rise_ps;
+	uint64_t timer;
+	if (!bus_low_count && !bus_high_count && dev->time < rise && rise < wake) wake = rise;
+	if (dev->regs[SIM_SREG] & SREG_I) {
+		timer = next_timer_event(dev);
+		if (timer < wake) wake = timer;
+	}
+	return wake;
+}
+
+//////////////////
+// Device side //
+//////////////////
+
+volatile uint8_t * sim_io(uint8_t reg) {
+	SIM_DEVICE_t * dev = current;
+	uint8_t level;
+	device_sync(1);
+	switch (reg) {
+		case SIM_PINA:
+			// SPIN_READS reads of the bus in a row, with nothing in between, is
+			// a `for (;;)` wait.  It would read the same thing until the bus
+			// changes or an interrupt runs, so sleep until then.
+			level = dev->level;
+			if (dev->spin_reads && level != dev->spin_level) dev->spin_reads = 0;
+			if (dev->spin_reads >= SPIN_READS) {
+				dev->wake = next_event(dev, SIM_NEVER);
+				dev->state = STATE_SLEEPING;
+				yield();
+				device_sync(0);
+				dev->spin_reads = 0;
+			}
+			dev->spin_reads++;
+			dev->spin_level = dev->level;
+			dev->regs[SIM_PINA] = (dev->regs[SIM_PORTA] & ~BUS_BIT) | (dev->level ? BUS_BIT : 0);
+			return &dev->regs[SIM_PINA];
+		case SIM_PINB:
+		case SIM_PINC:
+		case SIM_PIND:
+			// Outputs read back, and inputs read their pullups
+			dev->regs[reg] = dev->regs[reg + 2];
+			break;
+	}
+	dev->spin_reads = 0;
+	return &dev->regs[reg];
+}
+
+volatile uint16_t * sim_io16(uint8_t reg) {
+	current->spin_reads = 0;
+	device_sync(1);
+	return &current->regs16[reg];
+}
+
+void sim_cycles(uint32_t cycles) {
+	current->spin_reads = 0;
+	device_sync(cycles);
+}
+
+void sim_sleep(void) {
+	SIM_DEVICE_t * dev = current;
+	uint64_t interrupts = dev->stats.interrupts;
+	for (;;) {
+		device_sync(1);
+		if (dev->stats.interrupts != interrupts) return;
+		dev->wake = next_event(dev, SIM_NEVER);
+		dev->state = STATE_SLEEPING;
+		yield();
+	}
+}
+
+uint16_t sim_poll(volatile uint8_t * reg, uint8_t mask, uint8_t set, uint16_t iterations, uint8_t cycles) {
+	SIM_DEVICE_t * dev = current;
+	uint64_t poll_ps = cycles * dev->cycle_ps;
+	uint64_t start;
+	uint64_t k;
+	uint16_t n = iterations;
+
+	dev->spin_reads = 0;
+	if (!iterations) return 0;
+
+	// Anything other than the bus is polled the slow way
+	if (reg != &dev->regs[SIM_PINA] || mask != BUS_BIT) {
+		while (((*sim_io(reg - dev->regs) & mask) ? 1 : 0) != set && --n) sim_cycles(cycles - 1);
+		return n;
+	}
+
+	// The caller's &(reg) already synced us for the first check, at start.  Check
+	// k is at start + k * poll_ps .
+	start = dev->time;
+	for (;;) {
+		if (dev->level == set) {
+			k = (dev->time - start + poll_ps - 1) / poll_ps;
+			return (k < iterations) ? iterations - k : 1;
+		}
+		k = (dev->time - start + poll_ps - 1) / poll_ps;
+		if (k >= (uint64_t)iterations - 1) return 0;
+
+		// Sleep until the bus changes or the last check, then go to the check
+		// after that
+		dev->wake = next_event(dev, start + (iterations - 1) * poll_ps);
+		dev->state = STATE_SLEEPING;
+		yield();
+		k = (dev->time - start + poll_ps - 1) / poll_ps;
+		if (k > (uint64_t)iterations - 1) k = iterations - 1;
+		if (start + k * poll_ps > dev->time) dev->time = start + k * poll_ps;
+		device_sync(0);
+	}
+}
+
+void sim_sei(void) {
+	*sim_io(SIM_SREG) |= SREG_I;
+}
+
+void sim_cli(void) {
+	*sim_io(SIM_SREG) &= ~SREG_I;
+}
+
+void sim_eeprom_read(void * dst, uintptr_t addr, uint16_t len) {
+	if (addr + len > SIM_EEPROM_LEN) sim_fatal("eeprom read out of range");
+	memcpy(dst, &current->eeprom[addr], len);
+}
+
+void sim_eeprom_write(const void * src, uintptr_t addr, uint16_t len) {
+	if (addr + len > SIM_EEPROM_LEN) sim_fatal("eeprom write out of range");
+	memcpy(&current->eeprom[addr], src, len);
+}
+
+////////////////
+// Host side //
+////////////////
+
+void device_main(void) {
+	current->entry();
+	current->state = STATE_DONE;
+	// Let go of the bus
+	current->regs[SIM_DDRA] = 0;
+	update_drive(current);
+	_longjmp(scheduler_env, 1);
+}
+
+SIM_DEVICE_t * sim_add_device(const char * name, uint32_t f_cpu, void (*entry)(void),
+		void (*isr_pcint0)(void), void (*isr_tim0_compa)(void), void (*isr_tim1_compa)(void)) {
+	SIM_DEVICE_t * dev = calloc(1, sizeof(SIM_DEVICE_t));
+	if (!dev) sim_fatal("out of memory");
+	snprintf(dev->name, sizeof(dev->name), "%s", name);
+	dev->cycle_ps = 1000000000000ULL / f_cpu;
+	dev->entry = entry;
+	dev->isr_pcint0 = isr_pcint0;
+	dev->isr_tim0_compa = isr_tim0_compa;
+	dev->isr_tim1_compa = isr_tim1_compa;
+	dev->level = 1;
+	memset(dev->eeprom, 0xFF, SIM_EEPROM_LEN);
+
+	dev->stack = malloc(STACK_SIZE);
+	if (!dev->stack) sim_fatal("out of memory");
+	getcontext(&dev->context);
+	dev->context.uc_stack.ss_sp = dev->stack;
+	dev->context.uc_stack.ss_size = STACK_SIZE;
+	dev->context.uc_link = 0;
+	makecontext(&dev->context, device_main, 0);
+
+	if (last_device) {
+		last_device->next = dev;
+	} else {
+		devices = dev;
+	}
+	last_device = dev;
+	return dev;
+}
+
+SIM_DEVICE_t * sim_load_slave(const char * path, const char * name, const uint8_t * id) {
+	char copy_path[] = "/tmp/owsimXXXXXX";
+	char buf[65536];
+	FILE * src;
+	FILE * dst;
+	size_t n;
+	int fd;
+	void * handle;
+	void (*entry)(void);
+	uint32_t * f_cpu;
+	SIM_DEVICE_t * dev;
+
+	// dlopen() only loads a file once, so each slave gets its own copy (and its
+	// own globals)
+	src = fopen(path, "rb");
+	if (!src) return 0;
+	fd = mkstemp(copy_path);
+	if (fd < 0) {
+		fclose(src);
+		return 0;
+	}
+	dst = fdopen(fd, "wb");
+	while ((n = fread(buf, 1, sizeof(buf), src)) > 0) fwrite(buf, 1, n, dst);
+	fclose(src);
+	fclose(dst);
+	handle = dlopen(copy_path, RTLD_NOW | RTLD_LOCAL);
+	unlink(copy_path);
+	if (!handle) {
+		fprintf(stderr, "sim: %s\n", dlerror());
+		return 0;
+	}
+
+	entry = (void (*)(void))dlsym(handle, "sim_slave_main");
+	f_cpu = (uint32_t *)dlsym(handle, "sim_slave_f_cpu");
+	if (!entry || !f_cpu) return 0;
+	dev = sim_add_device(name, *f_cpu, entry,
+			(void (*)(void))dlsym(handle, "sim_isr_PCINT0_vect"),
+			(void (*)(void))dlsym(handle, "sim_isr_TIM0_COMPA_vect"),
+			(void (*)(void))dlsym(handle, "sim_isr_TIM1_COMPA_vect"));
+	sim_set_eeprom(dev, 0, id, 8);
+	return dev;
+}
+
+void sim_set_eeprom(SIM_DEVICE_t * device, uint16_t addr, const uint8_t * data, uint16_t len) {
+	memcpy(&device->eeprom[addr], data, len);
+}
+
+// Sleeping devices count at their wake time
+uint64_t device_key(SIM_DEVICE_t * d) {
+	if (d->state == STATE_DONE) return SIM_NEVER;
+	if (d->state == STATE_SLEEPING) return d->wake;
+	return d->time;
+}
+
+void sim_run(void) {
+	SIM_DEVICE_t * d;
+	SIM_DEVICE_t * next;
+	uint64_t key;
+	uint64_t next_key;
+
+	while (devices && devices->state != STATE_DONE) {
+		// Run the device furthest behind, up to the next one
+		next = devices;
+		next_key = device_key(devices);
+		horizon = SIM_NEVER;
+		for (d = devices->next; d; d = d->next) {
+			key = device_key(d);
+			if (key < next_key) {
+				horizon = next_key;
+				next = d;
+				next_key = key;
+			} else if (key < horizon) {
+				horizon = key;
+			}
+		}
+		if (next_key == SIM_NEVER) sim_fatal("every device is asleep");
+		if (next->state == STATE_SLEEPING) {
+			if (next->wake > next->time) next->time = next->wake;
+			next->state = STATE_RUNNABLE;
+		}
+		current = next;
+		if (!_setjmp(scheduler_env)) {
+			if (!next->started) {
+				next->started = 1;
+				setcontext(&next->context);
+			}
+			_longjmp(next->env, 1);
+		}
+		current = 0;
+	}
+}
+
+uint64_t sim_now_ps(void) {
+	SIM_DEVICE_t * d;
+	uint64_t now = 0;
+	if (current) return current->time;
+	for (d = devices; d; d = d->next) {
+		if (d->time > now) now = d->time;
+	}
+	return now;
+}
+
+SIM_BUS_t * sim_get_bus(void) {
+	return &bus;
+}
+
+SIM_DEVICE_STATS_t * sim_get_device_stats(SIM_DEVICE_t * device) {
+	return &device->stats;
+}
@@ -0,0 +1,131 @@
+/*
+ * Host (Linux) simulation HAL for the 1-Wire master and slave.
+ *
+ * The headers under sim/avr/ and sim/util/ stand in for avr-libc.  Every
+ * register access, delay, and interrupt enable goes through the functions below,
+ * so the unmodified master and slave sources run against a simulated device
+ * instead of hardware.  Each device (the master, and any number of slaves) runs
+ * in its own coroutine with its own clock.  The scheduler always runs the device
+ * that is furthest behind, so a device never sees another device's register
+ * writes before they happen.
+ *
+ * All devices share one bus: a wired-AND of their DALLAS_PORT/DALLAS_DDR pins
+ * (port A, pin DALLAS_PIN) with a pullup.  After the last device lets go, the
+ * bus reads high once the rise time has passed.
+ *
+ * The model of each device is small: ports A to D, SREG (only the I bit does
+ * anything), Timer 0 and Timer 1 (counting, CTC, and the compare A interrupt),
+ * the port A pin change interrupt, and the EEPROM.  Each register access costs
+ * one cycle, and delays cost what they would on the device.  Interrupts are
+ * taken at the next register access or delay, so an interrupt due during a
+ * delay runs when the delay ends.
+ *
+ * A device polling the bus (see sim_poll()) sleeps until the bus changes
+ * instead of checking it every few cycles, so a slot costs a handful of context
+ * switches.  So does a device that reads the bus several times in a row with
+ * nothing in between (a `for (;;)` wait), which means a loop that counts such
+ * reads to time out would wait too long; use the delay_helpers.h poll macros for
+ * those.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// Registers.  SIM_TCNT1 and up are 16 bits wide (sim_io16).
+enum {
+	SIM_PINA, SIM_DDRA, SIM_PORTA,
+	SIM_PINB, SIM_DDRB, SIM_PORTB,
+	SIM_PINC, SIM_DDRC, SIM_PORTC,
+	SIM_PIND, SIM_DDRD, SIM_PORTD,
+	SIM_SREG,
+	SIM_GIMSK, SIM_GIFR, SIM_PCMSK0,
+	SIM_TCCR0A, SIM_TCCR0B, SIM_TCNT0, SIM_OCR0A, SIM_OCR0B, SIM_TIMSK0, SIM_TIFR0,
+	SIM_TCCR1A, SIM_TCCR1B, SIM_TCCR1C, SIM_TIMSK1, SIM_TIFR1,
+	SIM_NUM_REGS
+};
+enum {
+	SIM_TCNT1, SIM_OCR1A, SIM_OCR1B, SIM_ICR1,
+	SIM_NUM_REGS16
+};
+
+// Size of each device's EEPROM
+#define SIM_EEPROM_LEN 512
+
+// Time is kept in picoseconds
+#define SIM_PS_PER_US 1000000ULL
+#define SIM_NEVER UINT64_MAX
+
+////////////////////////////////////////////
+// Device side (used through the shims)  //
+////////////////////////////////////////////
+
+// Syncs the current device and returns its register.  Costs one cycle.
+volatile uint8_t * sim_io(uint8_t reg);
+volatile uint16_t * sim_io16(uint8_t reg);
+
+// Spends cycles of the current device's clock
+void sim_cycles(uint32_t cycles);
+
+// Sleeps until an interrupt has run (like the sleep instruction)
+void sim_sleep(void);
+
+// The poll loops of delay_helpers.h.  Checks (*reg & mask) every cycles cycles,
+// up to iterations times, until it is nonzero (set) or zero (!set).  Returns the
+// number of iterations left counting the successful one, or 0 on timeout.  Polls
+// of the bus sleep until the next edge instead of checking every time.
+uint16_t sim_poll(volatile uint8_t * reg, uint8_t mask, uint8_t set, uint16_t iterations, uint8_t cycles);
+
+void sim_sei(void);
+void sim_cli(void);
+
+void sim_eeprom_read(void * dst, uintptr_t addr, uint16_t len);
+void sim_eeprom_write(const void * src, uintptr_t addr, uint16_t len);
+
+/////////////////////////////////
+// Host side (used by benches) //
+/////////////////////////////////
+
+typedef struct {
+	// Number of times the bus went low (one per slot or reset)
+	uint64_t falling_edges;
+	// Number of times a device drove the bus high while another pulled it low
+	uint64_t contentions;
+	// Time from the last device letting go until the bus reads high
+	uint64_t rise_ps;
+} SIM_BUS_t;
+
+typedef struct {
+	// Total and longest time with interrupts disabled, once they were first
+	// enabled
+	uint64_t irq_off_ps;
+	uint64_t irq_off_max_ps;
+	// Number of interrupts taken
+	uint64_t interrupts;
+} SIM_DEVICE_STATS_t;
+
+typedef struct SIM_DEVICE SIM_DEVICE_t;
+
+// Adds a device that runs entry() at f_cpu.  The device's interrupt handlers
+// (any of which may be null) are called when their interrupt is taken.
+SIM_DEVICE_t * sim_add_device(const char * name, uint32_t f_cpu, void (*entry)(void),
+		void (*isr_pcint0)(void), void (*isr_tim0_compa)(void), void (*isr_tim1_compa)(void));
+
+// Loads a fresh copy of a slave shared object (see sim_slave.c) as a new device
+// and writes id to the start of its EEPROM.  Returns null on failure.
+SIM_DEVICE_t * sim_load_slave(const char * path, const char * name, const uint8_t * id);
+
+// Writes to a device's EEPROM before it runs
+void sim_set_eeprom(SIM_DEVICE_t * device, uint16_t addr, const uint8_t * data, uint16_t len);
+
+// Runs the devices until the first one added returns from its entry function
+void sim_run(void);
+
+// Returns the current time (of the running device, or of the simulation)
+uint64_t sim_now_ps(void);
+
+SIM_BUS_t * sim_get_bus(void);
+SIM_DEVICE_STATS_t * sim_get_device_stats(SIM_DEVICE_t * device);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Slave firmware for the host simulation.  Built with ../slave/one_wire_slave.c
+ * into sim_slave.so, which sim_load_slave() loads once per simulated slave.
+ *
+ * Device commands:
+ * 0xBE: read scratchpad.  Sends the 8 byte scratchpad and its crc8.
+ * 0x4E: write scratchpad.  Reads 8 bytes into the scratchpad.
+ * 0xAA: sends the scratchpad over and over, until the master resets the bus.
+ * 0x0F: reads bytes, until the master resets the bus.
+ */
+
+#include <avr/io.h>
+#include <stdint.h>
+
+#include "sim.h"
+#include "one_wire_slave.h"
+
+#define READ_SCRATCHPAD_COMMAND 0xBE
+#define WRITE_SCRATCHPAD_COMMAND 0x4E
+#define STREAM_OUT_COMMAND 0xAA
+#define STREAM_IN_COMMAND 0x0F
+
+// Read by sim_load_slave()
+uint32_t sim_slave_f_cpu = F_CPU;
+
+uint8_t scratchpad[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+
+void handle_ows_command(uint8_t command) {
+	uint16_t crc = 0;
+	uint8_t b;
+
+	switch (command) {
+		case READ_SCRATCHPAD_COMMAND:
+			if (ows_write_buf_crc(scratchpad, sizeof(scratchpad), OWS_CRC8, &crc)) return;
+			ows_write_byte(crc);
+			break;
+		case WRITE_SCRATCHPAD_COMMAND:
+			ows_read_buf(scratchpad, sizeof(scratchpad));
+			break;
+		case STREAM_OUT_COMMAND:
+			while (!ows_write_buf(scratchpad, sizeof(scratchpad)));
+			break;
+		case STREAM_IN_COMMAND:
+			while (!ows_read_buf(&b, 1));
+			break;
+	}
+}
+
+void sim_slave_main(void) {
+	ows_setup();
+	for (;;) {
+		sim_sleep();
+	}
+}
@@ -0,0 +1,350 @@
+/*
+ * Runs the real master against simulated slaves on the simulated bus (see
+ * sim.h), checks the results, and reports throughput.
+ *
+ * Usage: simbench [-n slaves] [-r rise_ns] [-p timing_profile] [-q]
+ * -q runs fewer iterations, for `make check`.
+ *
+ * Phases:
+ * search: finds every slave with dallas_search_each()
+ * request: reads every slave's scratchpad with a checksummed dallas_request()
+ * buffer: streams bytes with dallas_read_buffer() and dallas_write_buffer()
+ * retry: requests again while a noise device glitches the bus, and reports the
+ *        per-device statistics
+ *
+ * Times are simulated (what the bus would take), except "wall", which is how long
+ * the host took.  Exits nonzero if a check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "sim.h"
+#include "dallas_one_wire.h"
+#include "one_wire_request.h"
+
+#define MAX_SLAVES DALLAS_DEVICE_STATS_LEN
+
+#define MASTER_F_CPU F_CPU
+#define NOISE_F_CPU 16000000UL
+
+#define READ_SCRATCHPAD_COMMAND 0xBE
+#define STREAM_OUT_COMMAND 0xAA
+#define STREAM_IN_COMMAND 0x0F
+
+// Initial scratchpad of every slave (see sim_slave.c)
+const uint8_t scratchpad[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+
+DALLAS_IDENTIFIER_t ids[MAX_SLAVES];
+uint8_t found[MAX_SLAVES];
+SIM_DEVICE_t * master;
+SIM_DEVICE_t * slaves[MAX_SLAVES];
+
+uint8_t num_slaves = 8;
+uint32_t rise_ns = 1000;
+uint8_t timing_profile = DALLAS_TIMING_STANDARD;
+uint8_t quick = 0;
+uint16_t failures = 0;
+
+// Set by the master to make the noise device glitch the bus
+volatile uint8_t noise_on = 0;
+uint32_t noise_glitches = 0;
+
+uint32_t rand_state = 0x12345678;
+
+uint32_t xorshift(void) {
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+void fail(const char * what) {
+	fprintf(stderr, "FAIL: %s\n", what);
+	failures++;
+}
+
+double wall_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One measured phase
+typedef struct {
+	uint64_t start_ps;
+	uint64_t start_edges;
+	double start_wall;
+} PHASE_t;
+
+void phase_start(PHASE_t * phase) {
+	phase->start_ps = sim_now_ps();
+	phase->start_edges = sim_get_bus()->falling_edges;
+	phase->start_wall = wall_seconds();
+}
+
+// Prints the phase, with bytes/s of simulated time if bytes isn't 0
+void phase_end(PHASE_t * phase, const char * name, uint32_t bytes) {
+	double sim_s = (sim_now_ps() - phase->start_ps) / 1e12;
+	uint64_t slots = sim_get_bus()->falling_edges - phase->start_edges;
+	double wall_s = wall_seconds() - phase->start_wall;
+
+	printf("%-8s %10.3f ms simulated  %9llu slots  %8.3f s wall  %10.0f slots/s",
+			name, sim_s * 1e3, (unsigned long long)slots, wall_s, slots / wall_s);
+	if (bytes) printf("  %8.0f bytes/s", bytes / sim_s);
+	printf("\n");
+}
+
+int8_t find_id(DALLAS_IDENTIFIER_t * id) {
+	uint8_t i;
+	for (i = 0; i < num_slaves; i++) {
+		if (!memcmp(ids[i].identifier, id->identifier, 8)) return i;
+	}
+	return -1;
+}
+
+void search_callback(DALLAS_IDENTIFIER_t * id) {
+	int8_t i = find_id(id);
+	if (i < 0) {
+		fail("search found an unknown identifier");
+	} else if (found[i]) {
+		fail("search found an identifier twice");
+	} else {
+		found[i] = 1;
+	}
+}
+
+void bench_search(void) {
+	PHASE_t phase;
+	uint8_t i;
+
+	memset(found, 0, sizeof(found));
+	phase_start(&phase);
+	if (dallas_search_each(SEARCH_ROM_COMMAND, search_callback)) fail("search failed");
+	phase_end(&phase, "search", 0);
+	for (i = 0; i < num_slaves; i++) {
+		if (!found[i]) fail("search missed an identifier");
+	}
+}
+
+// Reads every slave's scratchpad rounds times.  Returns the number of failed
+// requests.
+uint16_t read_scratchpads(uint16_t rounds, uint16_t flags) {
+	uint8_t request = READ_SCRATCHPAD_COMMAND;
+	uint8_t response[9];
+	uint16_t failed = 0;
+	uint16_t round;
+	uint8_t i;
+	uint8_t res;
+
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < num_slaves; i++) {
+			res = dallas_request(&ids[i], flags | DALLAS_REQ_EXPECT_CKSUM8, 1, &request, sizeof(response), response);
+			// The default policy hands bus error backoffs back instead of
+			// busy-waiting.  An application would do other work meanwhile.
+			while (res == DALLAS_ERR_RETRY_PENDING) {
+				_delay_us(dallas_retry_wait_us);
+				res = dallas_request(&ids[i], flags | DALLAS_REQ_EXPECT_CKSUM8, 1, &request, sizeof(response), response);
+			}
+			if (res || memcmp(response, scratchpad, sizeof(scratchpad))) {
+				failed++;
+			}
+		}
+	}
+	return failed;
+}
+
+void bench_request(void) {
+	PHASE_t phase;
+	uint16_t rounds = quick ? 2 : 50;
+
+	phase_start(&phase);
+	if (read_scratchpads(rounds, 0)) fail("request failed");
+	phase_end(&phase, "request", rounds * num_slaves * 9);
+}
+
+void bench_buffer(void) {
+	PHASE_t phase;
+	uint8_t buf[240];
+	uint16_t blocks = quick ? 2 : 40;
+	uint16_t i;
+
+	// Read
+	dallas_match_rom(&ids[0]);
+	dallas_write_byte(STREAM_OUT_COMMAND);
+	phase_start(&phase);
+	for (i = 0; i < blocks; i++) {
+		dallas_read_buffer(buf, sizeof(buf));
+		if (dallas_bus_error || memcmp(buf, scratchpad, sizeof(scratchpad))) {
+			fail("read buffer failed");
+			break;
+		}
+	}
+	phase_end(&phase, "read", blocks * sizeof(buf));
+
+	// Write
+	dallas_match_rom(&ids[0]);
+	dallas_write_byte(STREAM_IN_COMMAND);
+	memset(buf, 0x5A, sizeof(buf));
+	phase_start(&phase);
+	for (i = 0; i < blocks; i++) {
+		dallas_write_buffer(buf, sizeof(buf));
+		if (dallas_bus_error) {
+			fail("write buffer failed");
+			break;
+		}
+	}
+	phase_end(&phase, "write", blocks * sizeof(buf));
+	dallas_reset();
+}
+
+void bench_retry(void) {
+	PHASE_t phase;
+	DALLAS_DEVICE_STATS_t * stats;
+	uint32_t attempts = 0, retries = 0, crc_failures = 0, bus_errors = 0;
+	uint16_t rounds = quick ? 2 : 20;
+	uint16_t failed;
+	uint8_t i;
+
+	dallas_clear_device_stats();
+	noise_on = 1;
+	phase_start(&phase);
+	failed = read_scratchpads(rounds, DALLAS_REQ_RETRY);
+	phase_end(&phase, "retry", 0);
+	noise_on = 0;
+
+	for (i = 0; i < dallas_device_stats_count(); i++) {
+		stats = dallas_device_stats_at(i);
+		attempts += stats->attempts;
+		retries += stats->retries;
+		crc_failures += stats->crc_failures;
+		bus_errors += stats->bus_errors;
+	}
+	printf("         %u requests  %u glitches  %lu attempts  %lu retries  %lu crc failures  %lu bus errors  %u gave up\n",
+			rounds * num_slaves, noise_glitches, (unsigned long)attempts, (unsigned long)retries,
+			(unsigned long)crc_failures, (unsigned long)bus_errors, failed);
+	if (attempts != rounds * num_slaves + retries) fail("device statistics don't add up");
+}
+
+void master_main(void) {
+	// Give the slaves time to start up
+	_delay_ms(1);
+	dallas_setup();
+	if (dallas_set_timing_profile(timing_profile)) {
+		fail("bad timing profile");
+		return;
+	}
+	// Measure interrupts-off time in the master too
+	sei();
+
+	bench_search();
+	bench_request();
+	bench_buffer();
+	bench_retry();
+}
+
+// Glitches the bus with a 2 us low pulse every 2 to 10 ms (about once per
+// request) while noise_on is set
+void noise_main(void) {
+	for (;;) {
+		if (!noise_on) {
+			_delay_ms(1);
+			continue;
+		}
+		DDRA |= _BV(DALLAS_PIN);
+		_delay_us(2);
+		DDRA &= ~_BV(DALLAS_PIN);
+		noise_glitches++;
+		sim_cycles((2000 + xorshift() % 8000) * (NOISE_F_CPU / 1000000UL));
+	}
+}
+
+// Bitwise Maxim crc8 (the master's copy in maxim_crc.h is inline)
+uint8_t crc8(uint8_t * buf, uint8_t len) {
+	uint8_t crc = 0;
+	uint8_t i;
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+void make_id(DALLAS_IDENTIFIER_t * id) {
+	uint8_t i;
+	id->identifier[0] = 0x28;
+	for (i = 1; i < 7; i++) {
+		id->identifier[i] = xorshift();
+	}
+	id->identifier[7] = crc8(id->identifier, 7);
+}
+
+void usage(const char * name) {
+	fprintf(stderr, "Usage: %s [-n slaves] [-r rise_ns] [-p timing_profile] [-q]\n", name);
+	exit(2);
+}
+
+int main(int argc, char ** argv) {
+	SIM_DEVICE_STATS_t * stats;
+	uint64_t slave_irq_off_max = 0;
+	char name[16];
+	uint8_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:p:q")) != -1) {
+		switch (opt) {
+			case 'n': num_slaves = atoi(optarg); break;
+			case 'r': rise_ns = atoi(optarg); break;
+			case 'p': timing_profile = atoi(optarg); break;
+			case 'q': quick = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (num_slaves < 1 || num_slaves > MAX_SLAVES) usage(argv[0]);
+
+	sim_get_bus()->rise_ps = (uint64_t)rise_ns * 1000;
+
+	// The master goes first, so the simulation ends when it returns
+	master = sim_add_device("master", MASTER_F_CPU, master_main, 0, 0, 0);
+	for (i = 0; i < num_slaves; i++) {
+		make_id(&ids[i]);
+		snprintf(name, sizeof(name), "slave%u", i);
+		slaves[i] = sim_load_slave("./sim_slave.so", name, ids[i].identifier);
+		if (!slaves[i]) {
+			fprintf(stderr, "Can't load ./sim_slave.so\n");
+			return 2;
+		}
+	}
+	sim_add_device("noise", NOISE_F_CPU, noise_main, 0, 0, 0);
+
+	printf("%u slaves, %u ns rise time, timing profile %u\n", num_slaves, rise_ns, timing_profile);
+	sim_run();
+
+	stats = sim_get_device_stats(master);
+	printf("master   interrupts off %.3f ms total, %.1f us longest\n",
+			stats->irq_off_ps / 1e9, stats->irq_off_max_ps / 1e6);
+	for (i = 0; i < num_slaves; i++) {
+		stats = sim_get_device_stats(slaves[i]);
+		if (stats->irq_off_max_ps > slave_irq_off_max) slave_irq_off_max = stats->irq_off_max_ps;
+	}
+	printf("slaves   interrupts off %.1f us longest\n", slave_irq_off_max / 1e6);
+	printf("bus      %llu slots, %llu contentions\n",
+			(unsigned long long)sim_get_bus()->falling_edges, (unsigned long long)sim_get_bus()->contentions);
+
+	if (sim_get_bus()->contentions) fail("bus contention");
+	if (failures) {
+		printf("%u checks FAILED\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
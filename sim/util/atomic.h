@@ -0,0 +1,29 @@
+// Stand-in for <util/atomic.h> in the host simulation.  See sim/sim.h .
+// Same construction as avr-libc's.
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+static __inline__ uint8_t sim_iCliRetVal(void) {
+	sim_cli();
+	return 1;
+}
+
+static __inline__ void sim_iRestore(const uint8_t * sreg_save) {
+	SREG = *sreg_save;
+}
+
+static __inline__ void sim_iSeiParam(const uint8_t * unused) {
+	(void)unused;
+	sim_sei();
+}
+
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(sim_iRestore))) = SREG
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(sim_iSeiParam))) = 0
+
+#define ATOMIC_BLOCK(type) for (type, sim_todo = sim_iCliRetVal(); sim_todo; sim_todo = 0)
+
+#endif
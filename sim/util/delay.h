@@ -0,0 +1,14 @@
+// Stand-in for <util/delay.h> in the host simulation.  See sim/sim.h .
+//
+// Rounds up to whole cycles, like avr-libc does by default.
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "../sim.h"
+#include "delay_basic.h"
+
+#define _delay_us(us) sim_cycles((uint32_t)__builtin_ceil((double)(us) * ((double)F_CPU / 1e6)))
+#define _delay_ms(ms) sim_cycles((uint32_t)__builtin_ceil((double)(ms) * ((double)F_CPU / 1e3)))
+
+#endif
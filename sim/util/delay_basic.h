@@ -0,0 +1,13 @@
+// Stand-in for <util/delay_basic.h> in the host simulation.  See sim/sim.h .
+
+#ifndef SIM_UTIL_DELAY_BASIC_H
+#define SIM_UTIL_DELAY_BASIC_H
+
+#include "../sim.h"
+
+// 3 cycles per iteration, 0 is 256
+#define _delay_loop_1(n) sim_cycles(3UL * ((uint8_t)(n) ? (uint8_t)(n) : 256UL))
+// 4 cycles per iteration, 0 is 65536
+#define _delay_loop_2(n) sim_cycles(4UL * ((uint16_t)(n) ? (uint16_t)(n) : 65536UL))
+
+#endif
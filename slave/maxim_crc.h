@@ -0,0 +1 @@
+../common/maxim_crc.h
\ No newline at end of file
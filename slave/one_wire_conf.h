@@ -37,6 +37,60 @@
 //#define DALLAS_TIMER DALLAS_TIMER_1_16BIT
 //#define DALLAS_TIMER_VECT TIM1_COMPA_vect
 
+// Master slot backend (see dallas_one_wire.h)
+//#define DALLAS_BACKEND DALLAS_BACKEND_OC
+//#define DALLAS_BACKEND DALLAS_BACKEND_USART
+
+// Leaves overdrive out of the master.  Needed below about 6 MHz with the GPIO
+// backend.
+//#define DALLAS_NO_OVERDRIVE
+
+// Output for DALLAS_BACKEND_OC.  This must be the OC1B pin, and drives an
+// inverting transistor that pulls the bus low.  DALLAS_PIN must then be ICP1.
+// Uncomment if used (PA5 on the attiny44, PB2 on the atmega328p).
+//#define DALLAS_OC_DDR DDRA
+//#define DALLAS_OC_PORT PORTA
+//#define DALLAS_OC_PIN 5
+
+// Transmit pin for DALLAS_BACKEND_USART.  This must be TXD, and drives the bus
+// through an open-drain buffer.  DALLAS_PIN must then be RXD.  Uncomment if
+// used (PD1 on the atmega328p; the attiny44 has no USART).
+//#define DALLAS_USART_TX_DDR DDRD
+//#define DALLAS_USART_TX_PORT PORTD
+//#define DALLAS_USART_TX_PIN 1
+
+// Port for the multi-bus master (dallas_multi_bus.c).  Each pin is a separate
+// bus.  Comment out if not used.
+//#define DALLAS_MULTI_PORT PORTB
+//#define DALLAS_MULTI_PORT_IN PINB
+//#define DALLAS_MULTI_DDR DDRB
+
+// Multi-master arbitration (see dallas_one_wire.h)
+//#define DALLAS_TXN_TIMEOUT_MS 100
+//#define DALLAS_TXN_BACKOFF_SLOTS 16
+
+// Per-device request statistics (see one_wire_request.h).  The clock is any
+// free-running 16 bit counter, and sets the unit of bus_time.
+//#define DALLAS_DEVICE_STATS_LEN 8
+//#define DALLAS_STATS_CLOCK() TCNT1
+
+// Timeslot tracing (see one_wire_trace.h), for the master and/or the slave.
+// The clock is any free-running counter, and sets the unit of the timestamps.
+//#define DALLAS_TRACE
+//#define OWS_TRACE
+//#define OW_TRACE_LEN 16
+//#define OW_TRACE_CLOCK() TCNT1
+
+// Where the master saves its identifier list in EEPROM
+// (sizeof(DALLAS_IDENTIFIER_LIST_t) bytes).  Comment out if not used.
+//#define DALLAS_ID_LIST_EEPROM_ADDR (void *)16
+
+// Timer 1 compare match A vector for the interrupt-driven master
+// (dallas_one_wire_async.c).  Must not be the same timer as DALLAS_TIMER.
+// Uncomment if used (TIM1_COMPA_vect on the attiny44, TIMER1_COMPA_vect on the
+// atmega328p).
+//#define DALLAS_ASYNC_TIMER_VECT TIM1_COMPA_vect
+
 // Our own ID
 // Define one of these two
 #define OWS_ID { 0x88, 0x22, 0x44, 0xaa, 0xbb, 0x00, 0xff, 0x77 };
@@ -1,5 +1,6 @@
 #include "./one_wire_slave.h"
 #include "./delay_helpers.h"
+#include "./maxim_crc.h"
 #include <avr/io.h>
 #include <avr/cpufunc.h>
 #include <avr/interrupt.h>
@@ -16,7 +17,7 @@
 #ifdef OWS_DEBUG_LED_PORT
 #define led_on() OWS_DEBUG_LED_PORT &= ~_BV(OWS_DEBUG_LED_PIN);
 #define led_off() OWS_DEBUG_LED_PORT |= _BV(OWS_DEBUG_LED_PIN);
-inline void led_blink(uint8_t n) {
+static inline void led_blink(uint8_t n) {
 	uint8_t i;
 	for (i = 0; i < n; i++) {
 		led_on();
@@ -26,7 +27,7 @@ inline void led_blink(uint8_t n) {
 	}
 }
 
-inline void led_blink_bit(uint8_t b) {
+static inline void led_blink_bit(uint8_t b) {
 	if (b) {
 		led_on();
 		_delay_ms(800);
@@ -40,7 +41,7 @@ inline void led_blink_bit(uint8_t b) {
 	}
 }
 
-inline void led_blink_byte(uint8_t b) {
+static inline void led_blink_byte(uint8_t b) {
 	uint8_t p;
 	for(p = 0x80; p; p >>= 1) {
 		led_blink_bit(b & p);
@@ -67,64 +68,61 @@ uint8_t ows_error_flag = 0;
 #define pin_is_low() (!(DALLAS_PORT_IN & _BV(DALLAS_PIN)))
 #define pin_is_high() (DALLAS_PORT_IN & _BV(DALLAS_PIN))
 
-inline void clear_pin_isr() {
+static inline void clear_pin_isr() {
 	GIFR = 0;
 }
 
-inline void ows_bus_high() {
+static inline void ows_bus_high() {
 	// Set pin as input
 	DALLAS_DDR &= ~_BV(DALLAS_PIN);
 }
 
-inline void ows_bus_low() {
+static inline void ows_bus_low() {
 	// Configure pin as output (should already be low if initialized)
 	DALLAS_DDR |= _BV(DALLAS_PIN);
 }
 
 
-inline void wait_until_low() {
+static inline void wait_until_low() {
 	for(;;) {
 		if (pin_is_low()) return;
 	}
 }
 
-inline void wait_until_high() {
+static inline void wait_until_high() {
 	for(;;) {
 		if (pin_is_high()) return;
 	}
 }
 
-// Waits for up to max_us .  Returns 0 if pin is low.  Returns 1 if max is hit.
-inline uint8_t wait_until_low_timed(uint8_t max_us) {
-	// This loop takes 5 cycles without NOPs (on my compiler)
-	max_us = DELAY_ROUND_UP(max_us, 5);
-	for(;;) {
-		if (pin_is_low()) return 0;
-		//_NOP();
-		//_NOP();
-		//_NOP();
-		//--max_us;
-		DELAY_EXTRA_NOPS(5);
-		max_us -= DELAY_DECR_USECS(5);
-		if (!max_us) return 1;
-	}
-}
+// Waits for up to max_us (a constant).  Returns 0 if pin is low.  Returns 1 if max
+// is hit.
+#define wait_until_low_timed(max_us) DELAY_POLL_UNTIL_CLEAR(DALLAS_PORT_IN, DALLAS_PIN, max_us)
 
-// Waits for up to max_us.  Returns 0 if pin is high.  Returns 1 if max is hit.
-inline uint8_t wait_until_high_timed(uint8_t max_us) {
-	// This loop takes 5 cycles without NOPs (on my compiler)
-	max_us = DELAY_ROUND_UP(max_us, 5);
-	for(;;) {
-		if (pin_is_high()) return 0;
-		///_NOP();
-		///_NOP();
-		///_NOP();
-		///--max_us;
-		DELAY_EXTRA_NOPS(5);
-		max_us -= DELAY_DECR_USECS(5);
-		if (!max_us) return 1;
-	}
+#ifdef OWS_TRACE
+OW_TRACE_t ows_trace;
+// Poll iterations the bus took to come up the last time we waited for it
+uint16_t trace_recovery;
+
+#define trace_begin() trace_recovery = 0
+// Records the slot that just finished
+#define trace_slot(type, value) ow_trace_record(&ows_trace, ows_error_flag ? (type) | OW_TRACE_ERROR : (type), ows_error_flag ? ows_error_flag : (value), trace_recovery)
+
+OW_TRACE_t * get_ows_trace(void) {
+	return &ows_trace;
 }
+#else
+#define trace_begin()
+#define trace_slot(type, value)
+#endif
+
+// Waits for up to max_us (a constant).  Returns 0 if pin is high.  Returns 1 if max
+// is hit.
+#ifdef OWS_TRACE
+#define wait_until_high_timed(max_us) DELAY_POLL_UNTIL_SET_COUNTED(DALLAS_PORT_IN, DALLAS_PIN, max_us, trace_recovery)
+#else
+#define wait_until_high_timed(max_us) DELAY_POLL_UNTIL_SET(DALLAS_PORT_IN, DALLAS_PIN, max_us)
+#endif
 
 // Waits in units of 100 microseconds
 uint8_t wait_until_low_timed_ex(uint8_t timeval) {
@@ -135,17 +133,14 @@ uint8_t wait_until_low_timed_ex(uint8_t timeval) {
 	}
 }
 
-inline void time_bus_low(uint8_t us) {
+static inline void time_bus_low(uint8_t us) {
 	ows_bus_low();
 	//delay_unless_reset(us);
 	_delay_us(us);
 	ows_bus_high();
 }
 
-// Read 1 bit from the master (a WRITE 0 or WRITE 1)
-// Returns 0 if 0 bit, 1 if 1 bit
-// Also sets ows_error_flag
-inline uint8_t ows_read_bit_internal() {
+static inline uint8_t ows_read_slot() {
 	if (wait_until_low_timed_ex(100)) {
 		ows_error_flag = OWS_ERROR_TIMEOUT;
 		return 0;
@@ -161,12 +156,23 @@ inline uint8_t ows_read_bit_internal() {
 	}
 }
 
+// Read 1 bit from the master (a WRITE 0 or WRITE 1)
+// Returns 0 if 0 bit, 1 if 1 bit
+// Also sets ows_error_flag
+static inline uint8_t ows_read_bit_internal() {
+	uint8_t bit;
+	trace_begin();
+	bit = ows_read_slot();
+	trace_slot(OW_TRACE_WRITE, bit);
+	return bit;
+}
+
 uint8_t ows_read_bit() {
 	return ows_read_bit_internal();
 }
 
 // Read 1 byte from the master
-inline uint8_t ows_read_byte_internal() {
+static inline uint8_t ows_read_byte_internal() {
 	uint8_t bit;
 	uint8_t ret = 0;
 	for (bit = 0x01; bit; bit <<= 1) {
@@ -182,10 +188,7 @@ uint8_t ows_read_byte() {
 	return ows_read_byte_internal();
 }
 
-// Writes 1 bit back to the master
-// This is the equivalent of a READ 0 or READ 1 command
-// Also sets ows_error_flag
-inline void ows_write_bit_internal(uint8_t bit) {
+static inline void ows_write_slot(uint8_t bit) {
 	if (wait_until_low_timed_ex(100)) {
 		ows_error_flag = OWS_ERROR_TIMEOUT;
 		return;
@@ -203,12 +206,21 @@ inline void ows_write_bit_internal(uint8_t bit) {
 	}
 }
 
+// Writes 1 bit back to the master
+// This is the equivalent of a READ 0 or READ 1 command
+// Also sets ows_error_flag
+static inline void ows_write_bit_internal(uint8_t bit) {
+	trace_begin();
+	ows_write_slot(bit);
+	trace_slot(OW_TRACE_READ, bit ? 1 : 0);
+}
+
 void ows_write_bit(uint8_t bit) {
 	ows_write_bit_internal(bit);
 }
 
 // Writes 1 byte to the master
-inline void ows_write_byte_internal(uint8_t b) {
+static inline void ows_write_byte_internal(uint8_t b) {
 	uint8_t bit;
 	for (bit = 0x01; bit; bit <<= 1) {
 		if (ows_error_flag) return;
@@ -220,6 +232,45 @@ void ows_write_byte(uint8_t b) {
 	ows_write_byte_internal(b);
 }
 
+// Reads num_bits bits into buf, LSB of the first byte first.  Unused bits of the
+// last byte are cleared.
+// Returns nonzero on error.
+uint8_t ows_read_bits(uint8_t * buf, uint16_t num_bits) {
+	uint8_t bit = 0x01;
+	if (!num_bits) return 0;
+	*buf = 0;
+	while (num_bits) {
+		if (ows_read_bit_internal()) {
+			*buf |= bit;
+		}
+		if (ows_error_flag) return 1;
+		--num_bits;
+		bit <<= 1;
+		if (!bit && num_bits) {
+			bit = 0x01;
+			*++buf = 0;
+		}
+	}
+	return 0;
+}
+
+// Writes num_bits bits from buf, LSB of the first byte first.
+// Returns nonzero on error.
+uint8_t ows_write_bits(uint8_t * buf, uint16_t num_bits) {
+	uint8_t bit = 0x01;
+	while (num_bits) {
+		ows_write_bit_internal(*buf & bit);
+		if (ows_error_flag) return 1;
+		--num_bits;
+		bit <<= 1;
+		if (!bit) {
+			bit = 0x01;
+			++buf;
+		}
+	}
+	return 0;
+}
+
 // Reads len bytes into buffer buf.
 // Returns nonzero on error.
 uint8_t ows_read_buf(uint8_t * buf, uint8_t len) {
@@ -244,10 +295,72 @@ uint8_t ows_write_buf(uint8_t * buf, uint8_t len) {
 	return 0;
 }
 
+// Pushes a single bit into a running crc of the given type
+static inline void ows_crc_push_bit(uint8_t crc_type, uint16_t * crc, uint8_t bit) {
+	if (crc_type == OWS_CRC16) {
+		*crc = mcrc16_push_bit(*crc, bit);
+	} else {
+		*crc = mcrc8_push_bit((uint8_t)*crc, bit);
+	}
+}
+
+// Same as ows_read_byte(), but updates the crc after each bit while waiting for
+// the next timeslot
+uint8_t ows_read_byte_crc(uint8_t crc_type, uint16_t * crc) {
+	uint8_t bit;
+	uint8_t val;
+	uint8_t ret = 0;
+	for (bit = 0x01; bit; bit <<= 1) {
+		if (ows_error_flag) return 0;
+		val = ows_read_bit_internal();
+		if (val) {
+			ret |= bit;
+		}
+		ows_crc_push_bit(crc_type, crc, val);
+	}
+	return ret;
+}
+
+// Same as ows_write_byte(), but updates the crc after each bit while waiting for
+// the next timeslot
+void ows_write_byte_crc(uint8_t b, uint8_t crc_type, uint16_t * crc) {
+	uint8_t bit;
+	for (bit = 0x01; bit; bit <<= 1) {
+		if (ows_error_flag) return;
+		ows_write_bit_internal(b & bit);
+		ows_crc_push_bit(crc_type, crc, (b & bit) ? 1 : 0);
+	}
+}
+
+// Reads len bytes into buffer buf, accumulating the crc as it goes.
+// Returns nonzero on error.
+uint8_t ows_read_buf_crc(uint8_t * buf, uint8_t len, uint8_t crc_type, uint16_t * crc) {
+	while (len) {
+		*buf = ows_read_byte_crc(crc_type, crc);
+		if (ows_error_flag) return 1;
+		++buf;
+		--len;
+	}
+	return 0;
+}
+
+// Writes bytes out, accumulating the crc as it goes.  The crc is ready to be
+// sent as soon as the last byte is written.
+// Returns nonzero on error.
+uint8_t ows_write_buf_crc(uint8_t * buf, uint8_t len, uint8_t crc_type, uint16_t * crc) {
+	while (len) {
+		ows_write_byte_crc(*buf, crc_type, crc);
+		if (ows_error_flag) return 1;
+		++buf;
+		--len;
+	}
+	return 0;
+}
+
 // Returns 1 if device is selected and should read a device command
 // Returns 0 if device is not selected
 // ows_error_flag is set if relevant
-inline uint8_t ows_handle_rom_command(uint8_t command) {
+static inline uint8_t ows_handle_rom_command(uint8_t command) {
 	uint8_t i, bit, bitVal, direction, b;
 	uint8_t *id;
 	switch(command) {
@@ -291,8 +404,9 @@ inline uint8_t ows_handle_rom_command(uint8_t command) {
 }
 
 // Called immediately after a reset
-inline void ows_handle_reset() {
+static inline void ows_handle_reset() {
 	ows_error_flag = 0;
+	trace_begin();
 	// Wait until the pin returns to high
 	wait_until_high();
 	// Reset pulse finished.  Wait and emit the presence pulse.
@@ -302,8 +416,9 @@ inline void ows_handle_reset() {
 	// Wait for bus to recover
 	if (wait_until_high_timed(250)) {
 		ows_error_flag = OWS_ERROR_RESET;
-		return;
 	}
+	trace_slot(OW_TRACE_RESET, 1);
+	if (ows_error_flag) return;
 	// Read ROM command
 	uint8_t rom_command = ows_read_byte();
 	if (ows_error_flag) return;
@@ -314,7 +429,7 @@ inline void ows_handle_reset() {
 	handle_ows_command(dev_command);
 }
 
-inline void ows_handle_reset_isr() {
+static inline void ows_handle_reset_isr() {
 	for(;;) {
 		if (!pin_is_low()) return;
 		ows_handle_reset();
@@ -339,7 +454,7 @@ inline void ows_handle_reset_isr() {
 #define TIMER_OFF_REG 0b00001000
 #endif
 
-inline void start_timer() {
+static inline void start_timer() {
 #if DALLAS_TIMER == DALLAS_TIMER_0_8BIT
 	TCCR0B = TIMER_ON_REG;
 #elif DALLAS_TIMER == DALLAS_TIMER_1_16BIT
@@ -347,7 +462,7 @@ inline void start_timer() {
 #endif
 }
 
-inline void stop_timer() {
+static inline void stop_timer() {
 #if DALLAS_TIMER == DALLAS_TIMER_0_8BIT
 	TCCR0B = TIMER_OFF_REG;
 	TCNT0 = 0;
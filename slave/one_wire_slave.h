@@ -14,12 +14,20 @@
 #define OWS_SEARCH_ROM_COMMAND 0xF0
 #define OWS_READ_ROM_COMMAND 0x33
 
+// CRC types for the *_crc functions
+#define OWS_CRC8 1
+#define OWS_CRC16 2
+
 typedef struct {
 	uint8_t identifier[8];
 } OWS_IDENTIFIER_t;
 
 #include "./one_wire_conf.h"
 
+#ifdef OWS_TRACE
+#include "./one_wire_trace.h"
+#endif
+
 
 // Defined functions
 void ows_setup();
@@ -27,7 +35,22 @@ uint8_t ows_read_buf(uint8_t * buf, uint8_t len);
 uint8_t ows_write_buf(uint8_t * buf, uint8_t len);
 void ows_write_byte(uint8_t b);
 uint8_t ows_read_byte();
+// Bit-length versions of ows_read_buf() and ows_write_buf().  Bits are packed LSB
+// first.
+uint8_t ows_read_bits(uint8_t * buf, uint16_t num_bits);
+uint8_t ows_write_bits(uint8_t * buf, uint16_t num_bits);
+// These push each bit into the running crc (of type crc_type) between timeslots
+uint8_t ows_read_buf_crc(uint8_t * buf, uint8_t len, uint8_t crc_type, uint16_t * crc);
+uint8_t ows_write_buf_crc(uint8_t * buf, uint8_t len, uint8_t crc_type, uint16_t * crc);
+void ows_write_byte_crc(uint8_t b, uint8_t crc_type, uint16_t * crc);
+uint8_t ows_read_byte_crc(uint8_t crc_type, uint16_t * crc);
 void handle_pin_isr();
+// Our device identifier (set by ows_setup())
+extern OWS_IDENTIFIER_t ows_id;
+#ifdef OWS_TRACE
+// Returns the trace of the slots we took part in.  See one_wire_trace.h .
+OW_TRACE_t * get_ows_trace(void);
+#endif
 
 // Functions to implement
 void handle_ows_command(uint8_t command);